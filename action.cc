@@ -19,6 +19,8 @@
 /** @brief A special value to represent a failed trylock */
 #define VALUE_TRYFAILED 0
 
+SlabPool<model_malloc, model_free> ModelAction::pool;
+
 /**
  * @brief Construct a new ModelAction
  *
@@ -44,7 +46,8 @@ ModelAction::ModelAction(action_type_t type, memory_order order, void *loc,
     node(NULL),
     seq_number(ACTION_INITIAL_CLOCK),
     cv(NULL),
-    sleep_flag(false)
+    sleep_flag(false),
+    callstack(!model || model->params.callstacks)
 {
     /* References to NULL atomic variables can end up here */
     ASSERT(loc || type == ATOMIC_FENCE || type == MODEL_FIXUP_RELSEQ);
@@ -10,6 +10,7 @@
 
 #include "callstack.h"
 #include "mymemory.h"
+#include "slabpool.h"
 #include "memoryorder.h"
 #include "modeltypes.h"
 
@@ -185,8 +186,10 @@ public:
 
     bool may_read_from(const ModelAction *write) const;
     bool may_read_from(const Promise *promise) const;
-    MEMALLOC
+    POOLALLOC(pool)
 private:
+    /** @brief Recycles ModelActions, which come and go at every step */
+    static SlabPool<model_malloc, model_free> pool;
 
     const char * get_type_str() const;
     const char * get_mo_str() const;
@@ -254,7 +257,8 @@ private:
     bool sleep_flag;
 
     /**
-     *  Where was this instantiated from
+     *  Where was this instantiated from (raw program counters, symbolized
+     *  only when printed; empty if disabled with -k)
      */
     cdschecker::callstack callstack;
 };
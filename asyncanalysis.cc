@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "asyncanalysis.h"
+#include "common.h"
+#include "config.h"
+#include "traceanalysis.h"
+
+/** @brief An analysis process, and where it leaves its output and results */
+struct async_slot {
+    pid_t pid;
+    /** @brief Collects what the process prints */
+    int outfd;
+    /**
+     * @brief Shared with the process: the results saved by each of its
+     * analyses, as a size followed by that many bytes
+     */
+    char *results;
+};
+
+static struct async_slot *slots = NULL;
+static unsigned int num_slots = 0;
+/** @brief The slot of the oldest running process */
+static unsigned int head = 0;
+/** @brief Number of running (not yet collected) processes */
+static unsigned int num_busy = 0;
+
+/**
+ * @brief Set up running the trace analyses of up to a number of executions
+ * at once, while exploring further executions
+ * @param jobs The maximum number of analysis processes; 0 runs all analyses
+ * in line
+ */
+void async_analysis_init(unsigned int jobs)
+{
+    if (jobs == 0)
+        return;
+
+    char *results = (char *)mmap(NULL, (size_t)jobs * ASYNC_ANALYSIS_RESULT_SIZE,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+
+    slots = (struct async_slot *)model_calloc(jobs, sizeof(*slots));
+    for (unsigned int i = 0; i < jobs; i++) {
+        slots[i].outfd = memfd_create("analysis-output", MFD_CLOEXEC);
+        if (slots[i].outfd < 0) {
+            perror("memfd_create");
+            exit(EXIT_FAILURE);
+        }
+        slots[i].results = results + (size_t)i * ASYNC_ANALYSIS_RESULT_SIZE;
+    }
+    num_slots = jobs;
+}
+
+/** @return True if trace analyses may run in separate processes */
+bool async_analysis_enabled()
+{
+    return slots != NULL;
+}
+
+/**
+ * @brief Collect the oldest analysis process
+ * @param analyses The installed trace analyses
+ * @param block Wait for the process to finish, rather than leaving it be
+ * @return True if the process was collected
+ */
+static bool collect(ModelVector<TraceAnalysis *> *analyses, bool block)
+{
+    struct async_slot *slot = &slots[head];
+    int status;
+    if (wait_worker(slot->pid, &status, block) == 0)
+        return false;
+
+    flush_worker_output(slot->outfd);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        const char *results = slot->results;
+        for (unsigned int i = 0; i < analyses->size(); i++) {
+            TraceAnalysis *analysis = (*analyses)[i];
+            if (!analysis->canAnalyzeAsync())
+                continue;
+            size_t size;
+            memcpy(&size, results, sizeof(size));
+            results += sizeof(size);
+            analysis->mergeResults(results, size);
+            results += size;
+        }
+    } else {
+        model_print("A trace-analysis process failed\n");
+    }
+
+    head = (head + 1) % num_slots;
+    num_busy--;
+    return true;
+}
+
+/**
+ * @brief Run the trace analyses in a separate process
+ *
+ * Only the analyses supporting it (see TraceAnalysis::canAnalyzeAsync()) run
+ * in the forked process; the caller must run the others. Waits for the
+ * oldest process if there already are as many as permitted.
+ *
+ * @param analyses The installed trace analyses
+ * @param trace The complete execution's trace
+ * @return True if a process runs the supported analyses; false if the caller
+ * has to run all of them
+ */
+bool async_analysis_submit(ModelVector<TraceAnalysis *> *analyses, action_list_t *trace)
+{
+    if (!slots)
+        return false;
+
+    bool any = false;
+    for (unsigned int i = 0; i < analyses->size(); i++)
+        any |= (*analyses)[i]->canAnalyzeAsync();
+    if (!any)
+        return false;
+
+    /* Pass on finished results early, without waiting */
+    while (num_busy > 0 && collect(analyses, false))
+        ;
+    if (num_busy == num_slots)
+        collect(analyses, true);
+
+    struct async_slot *slot = &slots[(head + num_busy) % num_slots];
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    } else if (pid == 0) {
+        model_out = slot->outfd;
+        char *results = slot->results;
+        char *end = slot->results + ASYNC_ANALYSIS_RESULT_SIZE;
+        for (unsigned int i = 0; i < analyses->size(); i++) {
+            TraceAnalysis *analysis = (*analyses)[i];
+            if (!analysis->canAnalyzeAsync())
+                continue;
+            analysis->clearResults();
+            analysis->analyze(trace);
+            ASSERT(results + sizeof(size_t) <= end);
+            size_t size = analysis->saveResults(results + sizeof(size_t), end - results - sizeof(size_t));
+            memcpy(results, &size, sizeof(size));
+            results += sizeof(size) + size;
+        }
+        exit_worker();
+    }
+
+    slot->pid = pid;
+    num_busy++;
+    return true;
+}
+
+/** @brief Wait for all analysis processes, and collect their results */
+void async_analysis_drain(ModelVector<TraceAnalysis *> *analyses)
+{
+    while (num_busy > 0)
+        collect(analyses, true);
+}
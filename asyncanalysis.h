@@ -0,0 +1,25 @@
+/** @file asyncanalysis.h
+ *  @brief Trace analyses running alongside the exploration.
+ *
+ *  Each complete execution's trace analyses that support it (see
+ *  TraceAnalysis::canAnalyzeAsync()) run in a forked process, which works on
+ *  its own copy-on-write copy of the trace while the model checker explores
+ *  the next executions. A bounded number of these processes run at once; the
+ *  model checker waits for the oldest one when it needs another. Processes
+ *  are collected in the order they were started, so that their output and
+ *  results reach the model checker in execution order.
+ */
+
+#ifndef __ASYNCANALYSIS_H__
+#define __ASYNCANALYSIS_H__
+
+#include "model.h"
+
+class TraceAnalysis;
+
+void async_analysis_init(unsigned int jobs);
+bool async_analysis_enabled();
+bool async_analysis_submit(ModelVector<TraceAnalysis *> *analyses, action_list_t *trace);
+void async_analysis_drain(ModelVector<TraceAnalysis *> *analyses);
+
+#endif /* __ASYNCANALYSIS_H__ */
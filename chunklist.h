@@ -0,0 +1,279 @@
+/** @file chunklist.h
+ *  @brief Chunked list, for lists which mostly grow at the back.
+ */
+
+#ifndef __CHUNKLIST_H__
+#define __CHUNKLIST_H__
+
+#include <stddef.h>
+#include <string.h>
+#include <iterator>
+#include <type_traits>
+#include "mymemory.h"
+#include "common.h"
+
+/**
+ * @brief ChunkList iterator
+ *
+ * Refers to an element by its position, which survives growing the list at
+ * the back.
+ */
+template<typename _Tp, typename _List, typename _Ref, typename _Ptr>
+class chunklist_iterator {
+ public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef _Tp value_type;
+    typedef ptrdiff_t difference_type;
+    typedef _Ptr pointer;
+    typedef _Ref reference;
+
+    chunklist_iterator() : list(NULL), pos(0) { }
+    chunklist_iterator(_List *list, unsigned int pos) : list(list), pos(pos) { }
+
+    /** @brief Conversion from an iterator to a const iterator */
+    template<typename _OList, typename _ORef, typename _OPtr,
+        typename = typename std::enable_if<std::is_convertible<_OList *, _List *>::value>::type>
+    chunklist_iterator(const chunklist_iterator<_Tp, _OList, _ORef, _OPtr> &other) :
+        list(other.list), pos(other.pos) { }
+
+    _Ref operator*() const { return list->at_pos(pos); }
+    _Ptr operator->() const { return &list->at_pos(pos); }
+
+    chunklist_iterator & operator++() { pos++; return *this; }
+    chunklist_iterator operator++(int) { chunklist_iterator tmp = *this; pos++; return tmp; }
+    chunklist_iterator & operator--() { pos--; return *this; }
+    chunklist_iterator operator--(int) { chunklist_iterator tmp = *this; pos--; return tmp; }
+
+    bool operator==(const chunklist_iterator &other) const { return pos == other.pos; }
+    bool operator!=(const chunklist_iterator &other) const { return pos != other.pos; }
+
+    /** @brief Position of the element; see ChunkList */
+    unsigned int get_pos() const { return pos; }
+
+ private:
+    template<typename, typename, typename, typename>
+    friend class chunklist_iterator;
+
+    _List *list;
+    unsigned int pos;
+};
+
+/**
+ * @brief A list stored in fixed-size chunks
+ *
+ * Stores its elements contiguously within chunks of (1 << _Shift) elements,
+ * so that traversals don't chase a pointer per element. Elements never move
+ * while the list grows at the back; growing at the front moves the (short)
+ * chunk directory whenever the first chunk is full. Erasing moves the
+ * elements behind the erased one.
+ *
+ * Nothing is allocated until the first element is added. By default the
+ * chunks are snapshotting, so rolling back the list costs nothing extra.
+ *
+ * @tparam _Tp     Type name for the elements; must be trivially copyable
+ * @tparam _Shift  Log2 of the number of elements per chunk. Default 5.
+ * @tparam _malloc Provide your own 'malloc' for the list, or default to
+ *                 snapshotting.
+ * @tparam _free   Provide your own 'free' for the list, or default to
+ *                 snapshotting.
+ */
+template<typename _Tp, unsigned int _Shift = 5, void * (* _malloc)(size_t) = snapshot_malloc, void (*_free)(void *) = snapshot_free>
+class ChunkList {
+ public:
+    typedef _Tp value_type;
+    typedef size_t size_type;
+    typedef chunklist_iterator<_Tp, ChunkList, _Tp &, _Tp *> iterator;
+    typedef chunklist_iterator<_Tp, const ChunkList, const _Tp &, const _Tp *> const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    ChunkList() :
+        chunks(NULL),
+        num_chunks(0),
+        first(0),
+        count(0)
+    { }
+
+    ChunkList(const ChunkList &other) :
+        chunks(NULL),
+        num_chunks(0),
+        first(0),
+        count(0)
+    {
+        for (const_iterator it = other.begin(); it != other.end(); it++)
+            push_back(*it);
+    }
+
+    ChunkList(ChunkList &&other) noexcept :
+        chunks(other.chunks),
+        num_chunks(other.num_chunks),
+        first(other.first),
+        count(other.count)
+    {
+        other.chunks = NULL;
+        other.num_chunks = 0;
+        other.first = 0;
+        other.count = 0;
+    }
+
+    ~ChunkList() {
+        clear();
+    }
+
+    ChunkList & operator=(const ChunkList &other) {
+        if (this != &other) {
+            clear();
+            for (const_iterator it = other.begin(); it != other.end(); it++)
+                push_back(*it);
+        }
+        return *this;
+    }
+
+    /** Override: new operator */
+    void * operator new(size_t size) {
+        return _malloc(size);
+    }
+
+    /** Override: delete operator */
+    void operator delete(void *p, size_t size) {
+        _free(p);
+    }
+
+    /** Override: new[] operator */
+    void * operator new[](size_t size) {
+        return _malloc(size);
+    }
+
+    /** Override: delete[] operator */
+    void operator delete[](void *p, size_t size) {
+        _free(p);
+    }
+
+    /** Override: placement operator */
+    void * operator new(size_t size, void *p) {
+        return p;
+    }
+
+    iterator begin() { return iterator(this, first); }
+    iterator end() { return iterator(this, first + count); }
+    const_iterator begin() const { return const_iterator(this, first); }
+    const_iterator end() const { return const_iterator(this, first + count); }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    size_type size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    _Tp & front() { return at_pos(first); }
+    _Tp & back() { return at_pos(first + count - 1); }
+    const _Tp & front() const { return at_pos(first); }
+    const _Tp & back() const { return at_pos(first + count - 1); }
+
+    void push_back(const _Tp &val) {
+        unsigned int pos = first + count;
+        if ((pos >> _Shift) >= num_chunks || !chunks[pos >> _Shift])
+            add_chunk(pos >> _Shift);
+        at_pos(pos) = val;
+        count++;
+    }
+
+    void push_front(const _Tp &val) {
+        if (first == 0) {
+            /* Move the used chunks back by one, to make room in front */
+            unsigned int used = count ? ((count - 1) >> _Shift) + 1 : 0;
+            if (used >= num_chunks)
+                grow_directory(used + 1);
+            _Tp *spare = chunks[used];
+            memmove(&chunks[1], &chunks[0], used * sizeof(*chunks));
+            chunks[0] = spare;
+            first = CHUNK_SIZE;
+        }
+        first--;
+        if (!chunks[first >> _Shift])
+            add_chunk(first >> _Shift);
+        at_pos(first) = val;
+        count++;
+    }
+
+    void pop_front() {
+        ASSERT(count > 0);
+        first++;
+        count--;
+    }
+
+    void pop_back() {
+        ASSERT(count > 0);
+        count--;
+    }
+
+    /**
+     * @brief Remove an element
+     * @param it The element to remove
+     * @return An iterator to the element behind the removed one
+     */
+    iterator erase(iterator it) {
+        unsigned int end_pos = first + count;
+        for (unsigned int pos = it.get_pos(); pos + 1 < end_pos; pos++)
+            at_pos(pos) = at_pos(pos + 1);
+        count--;
+        return it;
+    }
+
+    /** @brief Remove all elements and release the chunks */
+    void clear() {
+        for (unsigned int i = 0; i < num_chunks; i++)
+            if (chunks[i])
+                _free(chunks[i]);
+        if (chunks)
+            _free(chunks);
+        chunks = NULL;
+        num_chunks = 0;
+        first = 0;
+        count = 0;
+    }
+
+    _Tp & at_pos(unsigned int pos) { return chunks[pos >> _Shift][pos & (CHUNK_SIZE - 1)]; }
+    const _Tp & at_pos(unsigned int pos) const { return chunks[pos >> _Shift][pos & (CHUNK_SIZE - 1)]; }
+
+ private:
+    static const unsigned int CHUNK_SIZE = 1 << _Shift;
+
+    /**
+     * @brief Allocate a chunk, unless already allocated
+     * @param idx The chunk's index in the directory
+     */
+    void add_chunk(unsigned int idx) {
+        if (idx >= num_chunks)
+            grow_directory(idx + 1);
+        if (!chunks[idx])
+            chunks[idx] = (_Tp *)_malloc(CHUNK_SIZE * sizeof(_Tp));
+    }
+
+    /** @brief Grow the chunk directory to at least a number of entries */
+    void grow_directory(unsigned int size) {
+        unsigned int newsize = num_chunks ? num_chunks * 2 : 1;
+        while (newsize < size)
+            newsize *= 2;
+        _Tp **newchunks = (_Tp **)_malloc(newsize * sizeof(*chunks));
+        if (chunks) {
+            memcpy(newchunks, chunks, num_chunks * sizeof(*chunks));
+            _free(chunks);
+        }
+        memset(&newchunks[num_chunks], 0, (newsize - num_chunks) * sizeof(*chunks));
+        chunks = newchunks;
+        num_chunks = newsize;
+    }
+
+    /** @brief Directory of chunks; unused entries are NULL */
+    _Tp **chunks;
+    /** @brief Number of entries in the chunk directory */
+    unsigned int num_chunks;
+    /** @brief Position of the first element */
+    unsigned int first;
+    /** @brief Number of elements */
+    unsigned int count;
+};
+
+#endif /* __CHUNKLIST_H__ */
@@ -6,6 +6,19 @@
 #include "common.h"
 #include "threads-model.h"
 
+SlabPool<> *ClockVector::pool = NULL;
+
+/**
+ * @brief Create the pool of ClockVectors
+ *
+ * Must be called before taking the first snapshot; otherwise rolling back
+ * would free the pool itself.
+ */
+void ClockVector::init_pool()
+{
+    pool = new SlabPool<>();
+}
+
 /**
  * Constructs a new ClockVector, given a parent ClockVector and a first
  * ModelAction. This constructor can assign appropriate default settings if no
@@ -21,7 +34,11 @@ ClockVector::ClockVector(ClockVector *parent, const ModelAction *act)
     if (parent && parent->num_threads > num_threads)
         num_threads = parent->num_threads;
 
-    clock = (modelclock_t *)snapshot_calloc(num_threads, sizeof(int));
+    if (num_threads <= CLOCKVECTOR_INLINE_THREADS) {
+        clock = inline_clock;
+        std::memset(inline_clock, 0, sizeof(inline_clock));
+    } else
+        clock = (modelclock_t *)snapshot_calloc(num_threads, sizeof(modelclock_t));
     if (parent)
         std::memcpy(clock, parent->clock, parent->num_threads * sizeof(modelclock_t));
 
@@ -31,7 +48,8 @@ ClockVector::ClockVector(ClockVector *parent, const ModelAction *act)
 /** @brief Destructor */
 ClockVector::~ClockVector()
 {
-    snapshot_free(clock);
+    if (clock != inline_clock)
+        snapshot_free(clock);
 }
 
 /**
@@ -44,12 +62,27 @@ bool ClockVector::merge(const ClockVector *cv)
     ASSERT(cv != NULL);
     bool changed = false;
     if (cv->num_threads > num_threads) {
-        clock = (modelclock_t *)snapshot_realloc(clock, cv->num_threads * sizeof(modelclock_t));
-        for (int i = num_threads; i < cv->num_threads; i++)
-            clock[i] = 0;
+        if (cv->num_threads > CLOCKVECTOR_INLINE_THREADS) {
+            if (clock == inline_clock) {
+                clock = (modelclock_t *)snapshot_malloc(cv->num_threads * sizeof(modelclock_t));
+                std::memcpy(clock, inline_clock, num_threads * sizeof(modelclock_t));
+            } else
+                clock = (modelclock_t *)snapshot_realloc(clock, cv->num_threads * sizeof(modelclock_t));
+            for (int i = num_threads; i < cv->num_threads; i++)
+                clock[i] = 0;
+        }
         num_threads = cv->num_threads;
     }
 
+    if (clock == inline_clock) {
+        /* Element-wise maximum of all inline clocks at once */
+        clock_lanes_t newer = (clock_lanes_t)(cv->inline_lanes > inline_lanes);
+        inline_lanes = (cv->inline_lanes & newer) | (inline_lanes & ~newer);
+        for (int i = 0; i < CLOCKVECTOR_INLINE_THREADS; i++)
+            changed |= newer[i] != 0;
+        return changed;
+    }
+
     /* Element-wise maximum */
     for (int i = 0; i < cv->num_threads; i++)
         if (cv->clock[i] > clock[i]) {
@@ -60,6 +93,25 @@ bool ClockVector::merge(const ClockVector *cv)
     return changed;
 }
 
+/**
+ * @brief Set this vector to the clocks of another one, e.g., to undo merges
+ * @param cv is the ClockVector to copy
+ */
+void ClockVector::assign(const ClockVector *cv)
+{
+    ASSERT(cv != NULL);
+    if (cv->num_threads > num_threads && cv->num_threads > CLOCKVECTOR_INLINE_THREADS) {
+        if (clock == inline_clock)
+            clock = (modelclock_t *)snapshot_malloc(cv->num_threads * sizeof(modelclock_t));
+        else
+            clock = (modelclock_t *)snapshot_realloc(clock, cv->num_threads * sizeof(modelclock_t));
+    }
+    std::memcpy(clock, cv->clock, cv->num_threads * sizeof(modelclock_t));
+    for (int i = cv->num_threads; i < num_threads; i++)
+        clock[i] = 0;
+    num_threads = cv->num_threads;
+}
+
 /**
  * Check whether this vector's thread has synchronized with another action's
  * thread. This effectively checks the happens-before relation (or actually,
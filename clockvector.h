@@ -6,7 +6,13 @@
 #define __CLOCKVECTOR_H__
 
 #include "mymemory.h"
+#include "slabpool.h"
 #include "modeltypes.h"
+#include "config.h"
+
+/** @brief The inline clocks of a ClockVector, as one (possibly unaligned)
+ *  vector */
+typedef modelclock_t clock_lanes_t __attribute__((vector_size(CLOCKVECTOR_INLINE_THREADS * sizeof(modelclock_t)), aligned(sizeof(modelclock_t))));
 
 /* Forward declaration */
 class ModelAction;
@@ -16,18 +22,33 @@ public:
     ClockVector(ClockVector *parent = NULL, const ModelAction *act = NULL);
     ~ClockVector();
     bool merge(const ClockVector *cv);
+    void assign(const ClockVector *cv);
     bool synchronized_since(const ModelAction *act) const;
 
     void print() const;
     modelclock_t getClock(thread_id_t thread);
 
-    SNAPSHOTALLOC
+    static void init_pool();
+
+    POOLALLOC(*pool)
 private:
-    /** @brief Holds the actual clock data, as an array. */
+    /** @brief Allocates the ClockVectors; lives in the snapshotting heap, so
+     *  that rollback frees the ClockVectors of the rolled back actions */
+    static SlabPool<> *pool;
+
+    /** @brief Holds the actual clock data, as an array; points to
+     *  inline_clock unless there are too many threads */
     modelclock_t *clock;
 
     /** @brief The number of threads recorded in clock (i.e., its length).  */
     int num_threads;
+
+    /** @brief Storage for the clocks of the first few threads; the clocks
+     *  past num_threads stay zero */
+    union {
+        modelclock_t inline_clock[CLOCKVECTOR_INLINE_THREADS];
+        clock_lanes_t inline_lanes;
+    };
 };
 
 #endif /* __CLOCKVECTOR_H__ */
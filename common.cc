@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/wait.h>
 
 #include <model-assert.h>
 
@@ -11,6 +12,7 @@
 #include "model.h"
 #include "stacktrace.h"
 #include "output.h"
+#include "stl-model.h"
 
 #define MAX_TRACE_LEN 100
 
@@ -56,10 +58,96 @@ void model_assert(bool expr, const char *file, int line)
     }
 }
 
+/**
+ * @brief Copy what a worker process printed to our output
+ *
+ * Worker processes (trace analyses, history checks) print to a memfd of
+ * their own, so that their output does not interleave with ours. The memfd is
+ * left empty for the next worker.
+ *
+ * @param fd The worker's output memfd
+ */
+void flush_worker_output(int fd)
+{
+    char buf[4096];
+    off_t offset = 0;
+    ssize_t res;
+    while ((res = pread(fd, buf, sizeof(buf), offset)) > 0) {
+        offset += res;
+        for (ssize_t done = 0; done < res; ) {
+            ssize_t written = write(model_out, buf + done, res - done);
+            if (written < 0) {
+                perror("write");
+                break;
+            }
+            done += written;
+        }
+    }
+    if (ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0)
+        perror("memfd reset");
+}
+
+/**
+ * @brief Wait for a worker process
+ * @param pid The worker process
+ * @param status Where to return its status
+ * @param block Wait for the process to finish, rather than leaving it be
+ * @return The pid, or 0 if it has not finished and block is false
+ */
+pid_t wait_worker(pid_t pid, int *status, bool block)
+{
+    pid_t res;
+    while ((res = waitpid(pid, status, block ? 0 : WNOHANG)) < 0) {
+        /* waitpid() may be interrupted */
+        if (errno != EINTR) {
+            perror("waitpid");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return res;
+}
+
+/** @brief End a worker process successfully */
+void exit_worker(void)
+{
+    /* Leave the model checker's exit handlers and buffers alone */
+    _exit(EXIT_SUCCESS);
+}
+
 #ifndef CONFIG_DEBUG
 
 static int fd_user_out; /**< @brief File descriptor from which to read user program output */
 
+/**
+ * @brief Program output produced before the latest partial-rollback snapshot
+ *
+ * A partially rolled back execution does not re-run its prefix, so the output
+ * of that prefix is kept here rather than regenerated.
+ */
+static ModelVector<char> *stashed_output;
+
+/** @brief Redirect the user program's stdout to a new pipe */
+static void open_program_output()
+{
+    int pipefd[2];
+    if (pipe(pipefd) < 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    if (dup2(pipefd[1], STDOUT_FILENO) < 0) {
+        perror("dup2");
+        exit(EXIT_FAILURE);
+    }
+    close(pipefd[1]);
+
+    /* Save the "read" side of the pipe for use later */
+    if (fcntl(pipefd[0], F_SETFL, O_NONBLOCK) < 0) {
+        perror("fcntl");
+        exit(EXIT_FAILURE);
+    }
+    fd_user_out = pipefd[0];
+}
+
 /**
  * @brief Setup output redirecting
  *
@@ -89,24 +177,21 @@ void redirect_output()
         exit(EXIT_FAILURE);
     }
 
-    /* Redirect program output to a pipe */
-    int pipefd[2];
-    if (pipe(pipefd) < 0) {
-        perror("pipe");
-        exit(EXIT_FAILURE);
-    }
-    if (dup2(pipefd[1], STDOUT_FILENO) < 0) {
-        perror("dup2");
-        exit(EXIT_FAILURE);
-    }
-    close(pipefd[1]);
+    open_program_output();
+    stashed_output = new ModelVector<char>();
+}
 
-    /* Save the "read" side of the pipe for use later */
-    if (fcntl(pipefd[0], F_SETFL, O_NONBLOCK) < 0) {
-        perror("fcntl");
-        exit(EXIT_FAILURE);
-    }
-    fd_user_out = pipefd[0];
+/**
+ * @brief Give a forked process its own program output pipe
+ *
+ * The pipe set up by redirect_output() is shared with the parent process, so
+ * a forked model-checking worker must not read from it.
+ */
+void reopen_program_output()
+{
+    close(fd_user_out);
+    open_program_output();
+    stashed_output->clear();
 }
 
 /**
@@ -143,6 +228,30 @@ void clear_program_output()
     while (read_to_buf(fd_user_out, buf, sizeof(buf)));
 }
 
+/**
+ * @brief Move any pending program output into the stash
+ * @return The total length of stashed output, to be passed to
+ * rollback_program_output() when rolling back to this point
+ */
+size_t stash_program_output()
+{
+    fflush(stdout);
+    char buf[200];
+    ssize_t ret;
+    while ((ret = read_to_buf(fd_user_out, buf, sizeof(buf))))
+        stashed_output->insert(stashed_output->end(), buf, buf + ret);
+    return stashed_output->size();
+}
+
+/**
+ * @brief Discard stashed program output beyond a rollback point
+ * @param len The stash length returned by stash_program_output()
+ */
+void rollback_program_output(size_t len)
+{
+    stashed_output->resize(len);
+}
+
 /** @brief Print out any pending program output */
 void print_program_output()
 {
@@ -150,6 +259,18 @@ void print_program_output()
 
     model_print("---- BEGIN PROGRAM OUTPUT ----\n");
 
+    /* Output from a prefix which was not replayed (partial rollback) */
+    size_t stashed = 0;
+    while (stashed < stashed_output->size()) {
+        ssize_t res = write(model_out, stashed_output->data() + stashed,
+                stashed_output->size() - stashed);
+        if (res < 0) {
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+        stashed += res;
+    }
+
     /* Gather all program output */
     fflush(stdout);
 
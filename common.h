@@ -6,6 +6,7 @@
 #define __COMMON_H__
 
 #include <stdio.h>
+#include <sys/types.h>
 #include "config.h"
 
 extern int model_out;
@@ -43,4 +44,8 @@ do { \
 #define error_msg(...) fprintf(stderr, "Error: " __VA_ARGS__)
 
 void print_trace(void);
+
+void flush_worker_output(int fd);
+pid_t wait_worker(pid_t pid, int *status, bool block);
+void exit_worker(void) __attribute__((noreturn));
 #endif /* __COMMON_H__ */
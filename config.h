@@ -32,11 +32,40 @@
 /** Snapshotting configurables */
 
 /** 
+ * If USE_MPROTECT_SNAPSHOT=3, then snapshot by tracking written pages with
+ * asynchronous userfaultfd write-protection (Linux 6.7 or later)
  * If USE_MPROTECT_SNAPSHOT=2, then snapshot by tuned mmap() algorithm
  * If USE_MPROTECT_SNAPSHOT=1, then snapshot by using mmap() and mprotect()
  * If USE_MPROTECT_SNAPSHOT=0, then snapshot by using fork() */
 #define USE_MPROTECT_SNAPSHOT 2
 
+/** Maximum number of mid-execution snapshots kept alive for partial
+ *  rollback. */
+#define MAX_ROLLBACK_POINTS 64
+
+/** Number of branch keys the workers of a parallel (--jobs) run can claim;
+ *  the table is reserved in shared memory but populated lazily. */
+#define PARALLEL_CLAIM_TABLE_SIZE (1 << 24)
+
+/** Maximum depth (in Nodes) of a branch one parallel worker can hand over
+ *  to an idle one; deeper branches stay with their owner. */
+#define PARALLEL_MAX_PREFIX 1024
+
+/** Number of handed-over branches that may wait for an idle worker. */
+#define PARALLEL_WORK_QUEUE_SIZE 16
+
+/** Space each process of an asynchronous (--analysisjobs) trace analysis has
+ *  for passing the results of its analyses back to the model checker. */
+#define ASYNC_ANALYSIS_RESULT_SIZE 4096
+
+/** How many keys ahead of the current lookup to HashTable::prefetch() when
+ *  looking up many keys in a row. */
+#define HASHTABLE_PREFETCH_DISTANCE 4
+
+/** Number of threads whose clocks a ClockVector stores inline (and merges
+ *  as one vector); with more threads the clocks move to the heap. */
+#define CLOCKVECTOR_INLINE_THREADS 8
+
 /** Size of signal stack */
 #define SIGSTACKSIZE 65536
 
@@ -48,9 +77,18 @@
 /* Size of stack to allocate for a thread. */
 #define STACK_SIZE (1024 * 1024)
 
+/** Number of guard-paged thread stacks to reserve up front and reuse across
+ *  executions; more threads take their stacks from the user heap. */
+#define STACK_POOL_SLOTS 64
+
 /** How many shadow tables of memory to preallocate for data race detector. */
 #define SHADOWBASETABLES 4
 
+/** Give the user heap a flat shadow table for the data race detector,
+ *  indexed directly by the offset into the heap, instead of the multi-level
+ *  shadow tables. Needs mprotect-based snapshotting. */
+#define FLAT_HEAP_SHADOW 1
+
 /** Enable debugging assertions (via ASSERT()) */
 #define CONFIG_ASSERT
 
@@ -25,3 +25,144 @@ int model_swapcontext(ucontext_t *oucp, ucontext_t *ucp)
 }
 
 #endif /* MAC */
+
+#if FAST_CONTEXT_SWITCH
+
+#include <stddef.h>
+
+/*
+ * model_fast_swapcontext() saves and restores the same ucontext_t fields as
+ * glibc's swapcontext(), so that it can resume contexts set up by
+ * makecontext(), and setcontext() can resume the contexts it saved. It skips
+ * the signal mask, and it only saves what a function call must preserve: the
+ * callee-saved registers, the stack pointer, the return address and the
+ * floating-point control state.
+ */
+
+#if defined(__x86_64__)
+
+/* The offsets hard-coded below */
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_R8]) == 40, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_R9]) == 48, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_R12]) == 72, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_R13]) == 80, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_R14]) == 88, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_R15]) == 96, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_RDI]) == 104, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_RSI]) == 112, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_RBP]) == 120, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_RBX]) == 128, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_RDX]) == 136, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_RCX]) == 152, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_RSP]) == 160, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs[REG_RIP]) == 168, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.fpregs) == 224, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, __fpregs_mem) == 424, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, __fpregs_mem.mxcsr) == 448, "ucontext_t layout");
+
+asm(
+    "    .text\n"
+    "    .p2align 4\n"
+    "    .globl model_fast_swapcontext\n"
+    "    .hidden model_fast_swapcontext\n"
+    "    .type model_fast_swapcontext, @function\n"
+    "model_fast_swapcontext:\n"
+    /* Save the caller's context in oucp (%rdi); it resumes by returning 0 */
+    "    movq %rbx, 128(%rdi)\n"
+    "    movq %rbp, 120(%rdi)\n"
+    "    movq %r12, 72(%rdi)\n"
+    "    movq %r13, 80(%rdi)\n"
+    "    movq %r14, 88(%rdi)\n"
+    "    movq %r15, 96(%rdi)\n"
+    "    movq (%rsp), %rcx\n"
+    "    movq %rcx, 168(%rdi)\n"
+    "    leaq 8(%rsp), %rcx\n"
+    "    movq %rcx, 160(%rdi)\n"
+    /* The x87 environment as fnstenv would store it, with an empty stack */
+    "    leaq 424(%rdi), %rcx\n"
+    "    movq %rcx, 224(%rdi)\n"
+    "    fnstcw (%rcx)\n"
+    "    movl $0, 4(%rcx)\n"
+    "    movl $0xffff, 8(%rcx)\n"
+    "    stmxcsr 448(%rdi)\n"
+    /* Restore ucp (%rsi); the argument registers matter for makecontext() */
+    "    fldcw 424(%rsi)\n"
+    "    ldmxcsr 448(%rsi)\n"
+    "    movq 160(%rsi), %rsp\n"
+    "    movq 128(%rsi), %rbx\n"
+    "    movq 120(%rsi), %rbp\n"
+    "    movq 72(%rsi), %r12\n"
+    "    movq 80(%rsi), %r13\n"
+    "    movq 88(%rsi), %r14\n"
+    "    movq 96(%rsi), %r15\n"
+    "    movq 168(%rsi), %r11\n"
+    "    movq 104(%rsi), %rdi\n"
+    "    movq 136(%rsi), %rdx\n"
+    "    movq 152(%rsi), %rcx\n"
+    "    movq 40(%rsi), %r8\n"
+    "    movq 48(%rsi), %r9\n"
+    "    movq 112(%rsi), %rsi\n"
+    "    xorl %eax, %eax\n"
+    "    jmpq *%r11\n"
+    "    .size model_fast_swapcontext, . - model_fast_swapcontext\n"
+);
+
+#elif defined(__aarch64__)
+
+/* The offsets hard-coded below; the FP/SIMD state is the first record of
+ * __reserved, as written by getcontext() */
+static_assert(offsetof(ucontext_t, uc_mcontext.regs[0]) == 184, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.regs[19]) == 336, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.sp) == 432, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.pc) == 440, "ucontext_t layout");
+static_assert(offsetof(ucontext_t, uc_mcontext.__reserved) == 464, "ucontext_t layout");
+
+asm(
+    "    .text\n"
+    "    .p2align 4\n"
+    "    .globl model_fast_swapcontext\n"
+    "    .hidden model_fast_swapcontext\n"
+    "    .type model_fast_swapcontext, %function\n"
+    "model_fast_swapcontext:\n"
+    /* Save the caller's context in oucp (x0); it resumes by returning 0 */
+    "    str xzr, [x0, #184]\n"
+    "    stp x19, x20, [x0, #336]\n"
+    "    stp x21, x22, [x0, #352]\n"
+    "    stp x23, x24, [x0, #368]\n"
+    "    stp x25, x26, [x0, #384]\n"
+    "    stp x27, x28, [x0, #400]\n"
+    "    stp x29, x30, [x0, #416]\n"
+    "    mov x2, sp\n"
+    "    stp x2, x30, [x0, #432]\n"
+    "    stp q8, q9, [x0, #608]\n"
+    "    stp q10, q11, [x0, #640]\n"
+    "    stp q12, q13, [x0, #672]\n"
+    "    stp q14, q15, [x0, #704]\n"
+    "    mrs x2, fpcr\n"
+    "    str w2, [x0, #476]\n"
+    /* Restore ucp (x1); the argument registers matter for makecontext() */
+    "    ldr w2, [x1, #476]\n"
+    "    msr fpcr, x2\n"
+    "    ldp q8, q9, [x1, #608]\n"
+    "    ldp q10, q11, [x1, #640]\n"
+    "    ldp q12, q13, [x1, #672]\n"
+    "    ldp q14, q15, [x1, #704]\n"
+    "    ldp x19, x20, [x1, #336]\n"
+    "    ldp x21, x22, [x1, #352]\n"
+    "    ldp x23, x24, [x1, #368]\n"
+    "    ldp x25, x26, [x1, #384]\n"
+    "    ldp x27, x28, [x1, #400]\n"
+    "    ldp x29, x30, [x1, #416]\n"
+    "    ldp x2, x16, [x1, #432]\n"
+    "    mov sp, x2\n"
+    "    ldp x2, x3, [x1, #200]\n"
+    "    ldp x4, x5, [x1, #216]\n"
+    "    ldp x6, x7, [x1, #232]\n"
+    "    ldp x0, x1, [x1, #184]\n"
+    "    br x16\n"
+    "    .size model_fast_swapcontext, . - model_fast_swapcontext\n"
+);
+
+#endif
+
+#endif /* FAST_CONTEXT_SWITCH */
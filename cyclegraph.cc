@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "cyclegraph.h"
 #include "action.h"
 #include "common.h"
@@ -8,6 +10,10 @@
 CycleGraph::CycleGraph() :
     discovered(new HashTable<const CycleNode *, const CycleNode *, uintptr_t, 4, model_malloc, model_calloc, model_free>(16)),
     queue(new ModelVector<const CycleNode *>()),
+    forward(new ModelVector<CycleNode *>()),
+    backward(new ModelVector<CycleNode *>()),
+    orders(new ModelVector<unsigned int>()),
+    nextOrder(0),
     hasCycles(false),
     oldCycles(false)
 {
@@ -18,6 +24,9 @@ CycleGraph::~CycleGraph()
 {
     delete queue;
     delete discovered;
+    delete forward;
+    delete backward;
+    delete orders;
 }
 
 /**
@@ -89,6 +98,7 @@ CycleNode * CycleGraph::getNode(const ModelAction *action)
     CycleNode *node = getNode_noCreate(action);
     if (node == NULL) {
         node = new CycleNode(action);
+        addNode(node, action->get_location());
         putNode(action, node);
     }
     return node;
@@ -108,11 +118,66 @@ CycleNode * CycleGraph::getNode(const Promise *promise)
     CycleNode *node = getNode_noCreate(promise);
     if (node == NULL) {
         node = new CycleNode(promise);
+        addNode(node, promise->get_reader(0)->get_location());
         putNode(promise, node);
     }
     return node;
 }
 
+static bool more_reachable(const CycleNode *a, const CycleNode *b)
+{
+    return __builtin_popcountll(a->getReachable()) > __builtin_popcountll(b->getReachable());
+}
+
+/**
+ * @brief Give the nodes of a location a topological order
+ *
+ * Used when the location outgrows its bitsets. These are exact, so (without
+ * cycles) each node reaches strictly more nodes than any of its successors.
+ * The nodes keep the same set of indices.
+ *
+ * @param loc The location, whose nodes may not have cycles
+ */
+void CycleGraph::sortLocation(struct cycle_location *loc)
+{
+    forward->clear();
+    orders->clear();
+    for (unsigned int i = 0; i < LOCATION_BITSET_NODES; i++) {
+        forward->push_back(loc->nodes[i]);
+        orders->push_back(loc->nodes[i]->getOrder());
+    }
+    std::sort(forward->begin(), forward->end(), more_reachable);
+    std::sort(orders->begin(), orders->end());
+    for (unsigned int i = 0; i < forward->size(); i++)
+        (*forward)[i]->setOrder((*orders)[i]);
+}
+
+/**
+ * @brief Set up a new CycleNode's topological index and location
+ * @param node The new node
+ * @param location The memory location it writes to
+ */
+void CycleGraph::addNode(CycleNode *node, const void *location)
+{
+    node->setOrder(nextOrder++);
+
+    struct cycle_location *loc = locations.get(location);
+    if (!loc) {
+        loc = new cycle_location();
+        locations.put(location, loc);
+    }
+    node->setLocation(loc, loc->nodes.size());
+    loc->nodes.push_back(node);
+
+    /* Switch from bitsets to the topological order */
+    if (loc->nodes.size() == LOCATION_BITSET_NODES + 1) {
+        if (hasCycles)
+            unsorted.push_back(loc);
+        else
+            sortLocation(loc);
+    }
+}
+
 /**
  * Resolve/satisfy a Promise with a particular store ModelAction, taking care
  * of the CycleGraph cleanups, including merging any necessary CycleNodes.
@@ -199,8 +264,8 @@ bool CycleGraph::addNodeEdge(CycleNode *fromnode, CycleNode *tonode)
 {
     if (fromnode->addEdge(tonode)) {
         rollbackvector.push_back(fromnode);
-        if (!hasCycles)
-            hasCycles = checkReachable(tonode, fromnode);
+        if (!updateReachable(fromnode, tonode))
+            hasCycles = true;
     } else
         return false; /* No new edge */
 
@@ -216,8 +281,8 @@ bool CycleGraph::addNodeEdge(CycleNode *fromnode, CycleNode *tonode)
 
         if (rmwnode != tonode) {
             if (rmwnode->addEdge(tonode)) {
-                if (!hasCycles)
-                    hasCycles = checkReachable(tonode, rmwnode);
+                if (!updateReachable(rmwnode, tonode))
+                    hasCycles = true;
 
                 rollbackvector.push_back(rmwnode);
             }
@@ -226,6 +291,139 @@ bool CycleGraph::addNodeEdge(CycleNode *fromnode, CycleNode *tonode)
     return true;
 }
 
+/**
+ * @brief Update the reachability information for a new edge
+ *
+ * Small locations keep the transitive closure in bitsets: every node reaching
+ * @a from (and @a from itself) now also reaches @a to and its successors.
+ * Larger locations maintain a topological order instead (see reorder()),
+ * except while the graph has cycles.
+ *
+ * @param from The new edge comes from this CycleNode
+ * @param to The new edge points to this CycleNode
+ * @return False if the new edge closes a cycle; true otherwise (or if the
+ * graph already has cycles in a large location)
+ */
+bool CycleGraph::updateReachable(CycleNode *from, CycleNode *to)
+{
+    struct cycle_location *loc = from->getLocation();
+    ASSERT(loc == to->getLocation());
+    if (!loc->has_bitsets())
+        return hasCycles || reorder(from, to);
+
+    uint64_t frombit = 1ULL << from->getLocationIndex();
+    uint64_t added = to->getReachable() | (1ULL << to->getLocationIndex());
+    for (unsigned int i = 0; i < loc->nodes.size(); i++) {
+        CycleNode *node = loc->nodes[i];
+        uint64_t reachable = node->getReachable();
+        if ((node == from || (reachable & frombit)) && (reachable | added) != reachable) {
+            struct reachable_undo undo = { node, reachable };
+            reachablerollbackvector.push_back(undo);
+            node->setReachable(reachable | added);
+        }
+    }
+    return !(added & frombit);
+}
+
+static bool order_less(const CycleNode *a, const CycleNode *b)
+{
+    return a->getOrder() < b->getOrder();
+}
+
+/**
+ * @brief Start loading the discovered-set entry of the node a few edges ahead
+ * of edge @a i, while a search visits edge @a i
+ */
+void CycleGraph::prefetchEdge(const CycleNode *node, unsigned int i) const
+{
+    i += HASHTABLE_PREFETCH_DISTANCE;
+    if (i < node->getNumEdges())
+        discovered->prefetch(node->getEdge(i));
+}
+
+/** @brief Like prefetchEdge(), for the back edges */
+void CycleGraph::prefetchBackEdge(const CycleNode *node, unsigned int i) const
+{
+    i += HASHTABLE_PREFETCH_DISTANCE;
+    if (i < node->getNumBackEdges())
+        discovered->prefetch(node->getBackEdge(i));
+}
+
+/**
+ * @brief Restore the topological order of the nodes after adding an edge
+ *
+ * Pearce-Kelly dynamic topological sort: when @a to already comes after
+ * @a from, nothing changes. Otherwise, only the nodes between the two in the
+ * order are affected. Those reachable from @a to move after those reaching
+ * @a from, reusing the same set of indices. Edges are only ever removed by
+ * rollbackChanges(), which keeps any order valid.
+ *
+ * @param from The new edge comes from this CycleNode
+ * @param to The new edge points to this CycleNode
+ * @return False if the new edge closes a cycle (and the order is left as it
+ * was); true otherwise
+ */
+bool CycleGraph::reorder(CycleNode *from, CycleNode *to)
+{
+    unsigned int lower = to->getOrder();
+    unsigned int upper = from->getOrder();
+    if (lower > upper)
+        return true;
+    if (from == to)
+        return false;
+
+    /* Nodes reachable from 'to' which are ordered before 'from' */
+    discovered->reset();
+    forward->clear();
+    forward->push_back(to);
+    discovered->put(to, to);
+    for (unsigned int i = 0; i < forward->size(); i++) {
+        CycleNode *node = (*forward)[i];
+        for (unsigned int j = 0; j < node->getNumEdges(); j++) {
+            prefetchEdge(node, j);
+            CycleNode *next = node->getEdge(j);
+            if (next == from)
+                return false;
+            if (next->getOrder() < upper && !discovered->contains(next)) {
+                discovered->put(next, next);
+                forward->push_back(next);
+            }
+        }
+    }
+
+    /* Nodes reaching 'from' which are ordered after 'to' */
+    backward->clear();
+    backward->push_back(from);
+    discovered->put(from, from);
+    for (unsigned int i = 0; i < backward->size(); i++) {
+        CycleNode *node = (*backward)[i];
+        for (unsigned int j = 0; j < node->getNumBackEdges(); j++) {
+            prefetchBackEdge(node, j);
+            CycleNode *prev = node->getBackEdge(j);
+            if (prev->getOrder() > lower && !discovered->contains(prev)) {
+                discovered->put(prev, prev);
+                backward->push_back(prev);
+            }
+        }
+    }
+
+    std::sort(forward->begin(), forward->end(), order_less);
+    std::sort(backward->begin(), backward->end(), order_less);
+    orders->clear();
+    for (unsigned int i = 0; i < backward->size(); i++)
+        orders->push_back((*backward)[i]->getOrder());
+    for (unsigned int i = 0; i < forward->size(); i++)
+        orders->push_back((*forward)[i]->getOrder());
+    std::sort(orders->begin(), orders->end());
+
+    unsigned int idx = 0;
+    for (unsigned int i = 0; i < backward->size(); i++)
+        (*backward)[i]->setOrder((*orders)[idx++]);
+    for (unsigned int i = 0; i < forward->size(); i++)
+        (*forward)[i]->setOrder((*orders)[idx++]);
+    return true;
+}
+
 /**
  * @brief Add an edge between a write and the RMW which reads from it
  *
@@ -266,8 +464,11 @@ void CycleGraph::addRMWEdge(const T *from, const ModelAction *rmw)
     for (unsigned int i = 0; i < fromnode->getNumEdges(); i++) {
         CycleNode *tonode = fromnode->getEdge(i);
         if (tonode != rmwnode) {
-            if (rmwnode->addEdge(tonode))
+            if (rmwnode->addEdge(tonode)) {
                 rollbackvector.push_back(rmwnode);
+                if (!updateReachable(rmwnode, tonode))
+                    hasCycles = true;
+            }
         }
     }
 
@@ -394,6 +595,16 @@ void CycleGraph::dumpGraphToFile(const char *filename) const
  */
 bool CycleGraph::checkReachable(const CycleNode *from, const CycleNode *to) const
 {
+    if (from->getLocation() != to->getLocation())
+        return false;
+    if (from->getLocation()->has_bitsets())
+        return from == to || (from->getReachable() & (1ULL << to->getLocationIndex()));
+
+    /* Without cycles, paths only lead towards higher topological indices */
+    bool ordered = !hasCycles;
+    if (ordered && from->getOrder() > to->getOrder())
+        return false;
+
     discovered->reset();
     queue->clear();
     queue->push_back(from);
@@ -404,7 +615,10 @@ bool CycleGraph::checkReachable(const CycleNode *from, const CycleNode *to) cons
         if (node == to)
             return true;
         for (unsigned int i = 0; i < node->getNumEdges(); i++) {
+            prefetchEdge(node, i);
             CycleNode *next = node->getEdge(i);
+            if (ordered && next->getOrder() > to->getOrder())
+                continue;
             if (!discovered->contains(next)) {
                 discovered->put(next, next);
                 queue->push_back(next);
@@ -460,6 +674,7 @@ bool CycleGraph::checkPromise(const ModelAction *fromact, Promise *promise) cons
             promise->eliminate_thread(node->getAction()->get_tid());
 
         for (unsigned int i = 0; i < node->getNumEdges(); i++) {
+            prefetchEdge(node, i);
             CycleNode *next = node->getEdge(i);
             if (!discovered->contains(next)) {
                 discovered->put(next, next);
@@ -475,6 +690,7 @@ void CycleGraph::startChanges()
 {
     ASSERT(rollbackvector.empty());
     ASSERT(rmwrollbackvector.empty());
+    ASSERT(reachablerollbackvector.empty());
     ASSERT(oldCycles == hasCycles);
 }
 
@@ -483,6 +699,7 @@ void CycleGraph::commitChanges()
 {
     rollbackvector.clear();
     rmwrollbackvector.clear();
+    reachablerollbackvector.clear();
     oldCycles = hasCycles;
 }
 
@@ -495,9 +712,21 @@ void CycleGraph::rollbackChanges()
     for (unsigned int i = 0; i < rmwrollbackvector.size(); i++)
         rmwrollbackvector[i]->clearRMW();
 
+    for (unsigned int i = reachablerollbackvector.size(); i > 0; i--) {
+        struct reachable_undo *undo = &reachablerollbackvector[i - 1];
+        undo->node->setReachable(undo->reachable);
+    }
+
     hasCycles = oldCycles;
     rollbackvector.clear();
     rmwrollbackvector.clear();
+    reachablerollbackvector.clear();
+
+    if (!hasCycles) {
+        for (unsigned int i = 0; i < unsorted.size(); i++)
+            sortLocation(unsorted[i]);
+        unsorted.clear();
+    }
 }
 
 /** @returns whether a CycleGraph contains cycles. */
@@ -513,7 +742,11 @@ bool CycleGraph::checkForCycles() const
 CycleNode::CycleNode(const ModelAction *act) :
     action(act),
     promise(NULL),
-    hasRMW(NULL)
+    hasRMW(NULL),
+    order(0),
+    location(NULL),
+    loc_index(0),
+    reachable(0)
 {
 }
 
@@ -524,7 +757,11 @@ CycleNode::CycleNode(const ModelAction *act) :
 CycleNode::CycleNode(const Promise *promise) :
     action(NULL),
     promise(promise),
-    hasRMW(NULL)
+    hasRMW(NULL),
+    order(0),
+    location(NULL),
+    loc_index(0),
+    reachable(0)
 {
 }
 
@@ -21,6 +21,28 @@ class Promise;
 class CycleNode;
 class ModelAction;
 
+/** @brief Locations with at most this many nodes track reachability with
+ *  bitsets */
+#define LOCATION_BITSET_NODES 64
+
+/**
+ * @brief The CycleNodes of a single memory location
+ *
+ * Modification order only relates writes to the same location, so no edge
+ * ever leads from one location to another.
+ */
+struct cycle_location {
+    SnapVector<CycleNode *> nodes;
+    bool has_bitsets() const { return nodes.size() <= LOCATION_BITSET_NODES; }
+    SNAPSHOTALLOC
+};
+
+/** @brief A reachability bitset as it was before an edge was added */
+struct reachable_undo {
+    CycleNode *node;
+    uint64_t reachable;
+};
+
 /** @brief A graph of Model Actions for tracking cycles. */
 class CycleGraph {
  public:
@@ -64,10 +86,30 @@ class CycleGraph {
     CycleNode * getNode_noCreate(const ModelAction *act) const;
     CycleNode * getNode_noCreate(const Promise *promise) const;
     bool mergeNodes(CycleNode *node1, CycleNode *node2);
+    void addNode(CycleNode *node, const void *location);
+    bool updateReachable(CycleNode *from, CycleNode *to);
+    bool reorder(CycleNode *from, CycleNode *to);
+    void prefetchEdge(const CycleNode *node, unsigned int i) const;
+    void prefetchBackEdge(const CycleNode *node, unsigned int i) const;
+    void sortLocation(struct cycle_location *loc);
 
     HashTable<const CycleNode *, const CycleNode *, uintptr_t, 4, model_malloc, model_calloc, model_free> *discovered;
     ModelVector<const CycleNode *> * queue;
 
+    /** @brief Scratch space for reorder() */
+    ModelVector<CycleNode *> *forward;
+    ModelVector<CycleNode *> *backward;
+    ModelVector<unsigned int> *orders;
+
+    /** @brief The topological order index for the next new node */
+    unsigned int nextOrder;
+
+    /** @brief A table for mapping memory locations to their nodes */
+    HashTable<const void *, struct cycle_location *, uintptr_t, 4> locations;
+    /** @brief Locations which outgrew their bitsets while the graph had
+     *  cycles, and so still need a topological order */
+    SnapVector<struct cycle_location *> unsorted;
+
 
     /** @brief A table for mapping ModelActions to CycleNodes */
     HashTable<const ModelAction *, CycleNode *, uintptr_t, 4> actionToNode;
@@ -87,6 +129,7 @@ class CycleGraph {
 
     SnapVector<CycleNode *> rollbackvector;
     SnapVector<CycleNode *> rmwrollbackvector;
+    SnapVector<struct reachable_undo> reachablerollbackvector;
 };
 
 /**
@@ -112,6 +155,13 @@ class CycleNode {
     const Promise * getPromise() const { return promise; }
     bool is_promise() const { return !action; }
     void resolvePromise(const ModelAction *writer);
+    unsigned int getOrder() const { return order; }
+    void setOrder(unsigned int o) { order = o; }
+    struct cycle_location * getLocation() const { return location; }
+    unsigned int getLocationIndex() const { return loc_index; }
+    void setLocation(struct cycle_location *loc, unsigned int index) { location = loc; loc_index = index; }
+    uint64_t getReachable() const { return reachable; }
+    void setReachable(uint64_t r) { reachable = r; }
 
     SNAPSHOTALLOC
  private:
@@ -131,6 +181,28 @@ class CycleNode {
     /** Pointer to a RMW node that reads from this node, or NULL, if none
      * exists */
     CycleNode *hasRMW;
+
+    /**
+     * @brief This node's index in a topological order of the graph
+     *
+     * Every edge leads from a lower to a higher index, as long as the graph
+     * has no cycles. Only maintained for locations without bitsets.
+     */
+    unsigned int order;
+
+    /** @brief The memory location this node writes to */
+    struct cycle_location *location;
+
+    /** @brief This node's index within its location */
+    unsigned int loc_index;
+
+    /**
+     * @brief Bitset of the nodes (by location index) reachable from this one
+     *
+     * Only maintained while the location has no more than
+     * LOCATION_BITSET_NODES nodes.
+     */
+    uint64_t reachable;
 };
 
 #endif /* __CYCLEGRAPH_H__ */
@@ -3,18 +3,52 @@
 #include "threads-model.h"
 #include <stdio.h>
 #include <cstring>
+#include <sys/mman.h>
 #include "mymemory.h"
 #include "clockvector.h"
 #include "config.h"
 #include "action.h"
 #include "execution.h"
 #include "stl-model.h"
+#include "snapshot.h"
 
 static struct ShadowTable *root;
 static SnapVector<DataRace *> *unrealizedraces;
 static void *memory_base;
 static void *memory_top;
 
+#if FLAT_HEAP_SHADOW && USE_MPROTECT_SNAPSHOT
+/** @brief Shadow records of the user heap, one per byte of the heap */
+static uint64_t *heap_shadow;
+static uintptr_t heap_base;
+static uintptr_t heap_size;
+#endif
+
+#if USE_MPROTECT_SNAPSHOT
+/**
+ * The shadow tables are not snapshotted: each shadow write is scattered and
+ * would cost a whole page copy. Instead, setShadow() logs the previous value
+ * of each record it changes, and rollBackRaceLog() restores them. Tables are
+ * never freed, so they stay valid across rollbacks.
+ */
+#define shadow_calloc(size) model_calloc(size, 1)
+
+/** @brief A run of shadow records which all had the same value */
+struct shadow_undo {
+    uint64_t *shadow;
+    uint64_t oldval;
+    size_t count;
+};
+
+/** @brief The records changed since the first snapshot, oldest first */
+static struct shadow_undo *undolog;
+static size_t undolog_size;
+static size_t undolog_capacity;
+#else
+/* Fork-based snapshots already cover all of our memory */
+#define shadow_calloc(size) snapshot_calloc(size, 1)
+#endif
+
 static const ModelExecution * get_execution()
 {
     return model->get_execution();
@@ -23,16 +57,37 @@ static const ModelExecution * get_execution()
 /** This function initialized the data race detector. */
 void initRaceDetector()
 {
-    root = (struct ShadowTable *)snapshot_calloc(sizeof(struct ShadowTable), 1);
-    memory_base = snapshot_calloc(sizeof(struct ShadowBaseTable) * SHADOWBASETABLES, 1);
+    root = (struct ShadowTable *)shadow_calloc(sizeof(struct ShadowTable));
+    memory_base = shadow_calloc(sizeof(struct ShadowBaseTable) * SHADOWBASETABLES);
     memory_top = ((char *)memory_base) + sizeof(struct ShadowBaseTable) * SHADOWBASETABLES;
     unrealizedraces = new SnapVector<DataRace *>();
+#if USE_MPROTECT_SNAPSHOT
+    undolog_capacity = 1024;
+    undolog = (struct shadow_undo *)model_malloc(undolog_capacity * sizeof(*undolog));
+#endif
+
+#if FLAT_HEAP_SHADOW && USE_MPROTECT_SNAPSHOT
+    /* Reserved up front, populated by the kernel page by page on first use */
+    void *base;
+    size_t size;
+    snapshot_get_user_heap(&base, &size);
+    size_t shadow_size = size * sizeof(uint64_t);
+    void *shadow = mmap(NULL, shadow_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (shadow == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    heap_shadow = (uint64_t *)shadow;
+    heap_base = (uintptr_t)base;
+    heap_size = size;
+#endif
 }
 
 void * table_calloc(size_t size)
 {
     if ((((char *)memory_base) + size) > memory_top) {
-        return snapshot_calloc(size, 1);
+        return shadow_calloc(size);
     } else {
         void *tmp = memory_base;
         memory_base = ((char *)memory_base) + size;
@@ -44,6 +99,12 @@ void * table_calloc(size_t size)
  * given address.*/
 static uint64_t * lookupAddressEntry(const void *address)
 {
+#if FLAT_HEAP_SHADOW && USE_MPROTECT_SNAPSHOT
+    uintptr_t offset = (uintptr_t)address - heap_base;
+    if (offset < heap_size)
+        return &heap_shadow[offset];
+#endif
+
     struct ShadowTable *currtable = root;
 #if BIT48
     currtable = (struct ShadowTable *) currtable->array[(((uintptr_t)address) >> 32) & MASK16BIT];
@@ -59,6 +120,88 @@ static uint64_t * lookupAddressEntry(const void *address)
     return &basetable->array[((uintptr_t)address) & MASK16BIT];
 }
 
+/**
+ * @brief Updates a run of shadow records, so that rollBackRaceLog() can
+ * restore them
+ * @param shadow The first record
+ * @param count The number of records; they must all have the same value
+ * @param val The new value for all of the records
+ */
+static void setShadowRun(uint64_t *shadow, size_t count, uint64_t val)
+{
+    if (count == 0)
+        return;
+#if USE_MPROTECT_SNAPSHOT
+    if (*shadow == val)
+        return;
+    if (undolog_size == undolog_capacity) {
+        struct shadow_undo *newlog = (struct shadow_undo *)model_malloc(2 * undolog_capacity * sizeof(*undolog));
+        std::memcpy(newlog, undolog, undolog_capacity * sizeof(*undolog));
+        model_free(undolog);
+        undolog = newlog;
+        undolog_capacity *= 2;
+    }
+    struct shadow_undo *undo = &undolog[undolog_size++];
+    undo->shadow = shadow;
+    undo->oldval = *shadow;
+    undo->count = count;
+#endif
+    for (size_t i = 0; i < count; i++)
+        shadow[i] = val;
+}
+
+/** This function updates a shadow record; see setShadowRun(). */
+static inline void setShadow(uint64_t *shadow, uint64_t val)
+{
+    setShadowRun(shadow, 1, val);
+}
+
+/** @return The position in the log of shadow record changes, to pass to
+ *  rollBackRaceLog() */
+size_t getRaceLogMark()
+{
+#if USE_MPROTECT_SNAPSHOT
+    return undolog_size;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Restore the shadow records to their values at a mark
+ *
+ * Must accompany rolling back the snapshot taken at the mark.
+ *
+ * @param mark The mark; see getRaceLogMark()
+ */
+void rollBackRaceLog(size_t mark)
+{
+#if USE_MPROTECT_SNAPSHOT
+    while (undolog_size > mark) {
+        struct shadow_undo *undo = &undolog[--undolog_size];
+        for (size_t i = 0; i < undo->count; i++)
+            undo->shadow[i] = undo->oldval;
+    }
+#endif
+}
+
+/**
+ * @return The number of bytes, starting at a given address, whose shadow
+ * records are consecutive
+ */
+static size_t shadowSpan(const void *address)
+{
+    size_t span = MASK16BIT + 1 - (((uintptr_t)address) & MASK16BIT);
+#if FLAT_HEAP_SHADOW && USE_MPROTECT_SNAPSHOT
+    uintptr_t offset = (uintptr_t)address - heap_base;
+    if (offset < heap_size)
+        return heap_size - offset;
+    if ((uintptr_t)address < heap_base && heap_base - (uintptr_t)address < span)
+        return heap_base - (uintptr_t)address;
+#endif
+    return span;
+}
+
 /**
  * Compares a current clock-vector/thread-ID pair with a clock/thread-ID pair
  * to check the potential for a data race.
@@ -99,7 +242,7 @@ static void expandRecord(uint64_t *shadow)
         record->thread[0] = readThread;
         record->readClock[0] = readClock;
     }
-    *shadow = (uint64_t) record;
+    setShadow(shadow, (uint64_t) record);
 }
 
 /** This function is called when we detect a data race.*/
@@ -172,7 +315,7 @@ void assert_race(struct DataRace *race)
 }
 
 /** This function does race detection for a write on an expanded record. */
-void fullRaceCheckWrite(thread_id_t thread, void *location, uint64_t *shadow, ClockVector *currClock)
+static void fullRaceCheckWrite(thread_id_t thread, void *location, uint64_t *shadow, ClockVector *currClock)
 {
     struct RaceRecord *record = (struct RaceRecord *)(*shadow);
 
@@ -207,12 +350,10 @@ void fullRaceCheckWrite(thread_id_t thread, void *location, uint64_t *shadow, Cl
     record->writeClock = ourClock;
 }
 
-/** This function does race detection on a write. */
-void raceCheckWrite(thread_id_t thread, void *location)
+/** This function does race detection on a write to one byte. */
+static void raceCheckWriteByte(thread_id_t thread, void *location, uint64_t *shadow, ClockVector *currClock)
 {
-    uint64_t *shadow = lookupAddressEntry(location);
     uint64_t shadowval = *shadow;
-    ClockVector *currClock = get_execution()->get_cv(thread);
 
     /* Do full record */
     if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
@@ -249,11 +390,11 @@ void raceCheckWrite(thread_id_t thread, void *location)
         /* We have a datarace */
         reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), true, location);
     }
-    *shadow = ENCODEOP(0, 0, threadid, ourClock);
+    setShadow(shadow, ENCODEOP(0, 0, threadid, ourClock));
 }
 
 /** This function does race detection on a read for an expanded record. */
-void fullRaceCheckRead(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
+static void fullRaceCheckRead(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
 {
     struct RaceRecord *record = (struct RaceRecord *) (*shadow);
 
@@ -311,12 +452,10 @@ void fullRaceCheckRead(thread_id_t thread, const void *location, uint64_t *shado
     record->numReads = copytoindex + 1;
 }
 
-/** This function does race detection on a read. */
-void raceCheckRead(thread_id_t thread, const void *location)
+/** This function does race detection on a read of one byte. */
+static void raceCheckReadByte(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
 {
-    uint64_t *shadow = lookupAddressEntry(location);
     uint64_t shadowval = *shadow;
-    ClockVector *currClock = get_execution()->get_cv(thread);
 
     /* Do full record */
     if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
@@ -354,7 +493,97 @@ void raceCheckRead(thread_id_t thread, const void *location)
         return;
     }
 
-    *shadow = ENCODEOP(threadid, ourClock, id_to_int(writeThread), writeClock);
+    setShadow(shadow, ENCODEOP(threadid, ourClock, id_to_int(writeThread), writeClock));
+}
+
+/**
+ * @brief Does race detection on an access to consecutive bytes
+ *
+ * The bytes of a variable which was last accessed as a whole share the same
+ * compact record, and accessing them has the same outcome for each byte. So
+ * each run of bytes with the same compact record is checked once, and the
+ * resulting record is copied to the rest of the run. Races are reported for
+ * the first byte of the run only.
+ *
+ * @param location The first byte
+ * @param shadow The shadow record of the first byte; the records of all the
+ * bytes must be consecutive, i.e., in one ShadowBaseTable
+ * @param size The number of bytes
+ * @param checkByte Does race detection on a single byte
+ */
+template<typename _Ptr>
+static void raceCheckBytes(thread_id_t thread, _Ptr location, uint64_t *shadow, size_t size,
+        void (*checkByte)(thread_id_t, _Ptr, uint64_t *, ClockVector *))
+{
+    ClockVector *currClock = get_execution()->get_cv(thread);
+    for (size_t i = 0; i < size; ) {
+        uint64_t shadowval = shadow[i];
+        size_t end = i + 1;
+        if (ISSHORTRECORD(shadowval) || shadowval == 0)
+            while (end < size && shadow[end] == shadowval)
+                end++;
+
+        checkByte(thread, (_Ptr)((uintptr_t)location + i), &shadow[i], currClock);
+        if (!ISSHORTRECORD(shadow[i])) {
+            /* Expanded; the other bytes of the run get their own records */
+            i++;
+            continue;
+        }
+        setShadowRun(&shadow[i + 1], end - i - 1, shadow[i]);
+        i = end;
+    }
+}
+
+/**
+ * @brief Does race detection on an access to a range of bytes
+ *
+ * Walks the range one ShadowBaseTable (or the heap's flat shadow table) at a
+ * time, so a range costs one shadow table lookup per 64 KB rather than per
+ * byte.
+ *
+ * @param location The range's first byte
+ * @param size The range's size in bytes
+ * @param checkByte Does race detection on a single byte
+ */
+template<typename _Ptr>
+static void raceCheckRange(thread_id_t thread, _Ptr location, size_t size,
+        void (*checkByte)(thread_id_t, _Ptr, uint64_t *, ClockVector *))
+{
+    while (size > 0) {
+        size_t span = shadowSpan(location);
+        if (span > size)
+            span = size;
+        raceCheckBytes(thread, location, lookupAddressEntry(location), span, checkByte);
+        location = (_Ptr)((uintptr_t)location + span);
+        size -= span;
+    }
+}
+
+/** This function does race detection on a write. */
+void raceCheckWrite(thread_id_t thread, void *location)
+{
+    raceCheckWriteByte(thread, location, lookupAddressEntry(location), get_execution()->get_cv(thread));
+}
+
+/** This function does race detection on a write of a range of bytes, e.g., of
+ *  a multi-byte variable or by memset() or memcpy(); with one shadow table
+ *  lookup per shadow table the range spans. */
+void raceCheckWriteRange(thread_id_t thread, void *location, size_t size)
+{
+    raceCheckRange(thread, location, size, raceCheckWriteByte);
+}
+
+/** This function does race detection on a read. */
+void raceCheckRead(thread_id_t thread, const void *location)
+{
+    raceCheckReadByte(thread, location, lookupAddressEntry(location), get_execution()->get_cv(thread));
+}
+
+/** This function does race detection on a read of a range of bytes, e.g., of
+ *  a multi-byte variable or by memcmp() or memcpy(). */
+void raceCheckReadRange(thread_id_t thread, const void *location, size_t size)
+{
+    raceCheckRange(thread, location, size, raceCheckReadByte);
 }
 
 bool haveUnrealizedRaces()
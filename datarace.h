@@ -6,6 +6,7 @@
 #define __DATARACE_H__
 
 #include "config.h"
+#include <stddef.h>
 #include <stdint.h>
 #include "modeltypes.h"
 
@@ -44,9 +45,13 @@ struct DataRace {
 void initRaceDetector();
 void raceCheckWrite(thread_id_t thread, void *location);
 void raceCheckRead(thread_id_t thread, const void *location);
+void raceCheckWriteRange(thread_id_t thread, void *location, size_t size);
+void raceCheckReadRange(thread_id_t thread, const void *location, size_t size);
 bool checkDataRaces();
 void assert_race(struct DataRace *race);
 bool haveUnrealizedRaces();
+size_t getRaceLogMark();
+void rollBackRaceLog(size_t mark);
 
 /**
  * @brief A record of information for detecting data races
@@ -73,11 +73,14 @@ ModelExecution::ModelExecution(ModelChecker *m,
     obj_map(),
     condvar_waiters_map(),
     obj_thrd_map(),
+    obj_index(),
     promises(),
     futurevalues(),
     pending_rel_seqs(),
     thrd_last_action(1),
     thrd_last_fence_release(),
+    thrd_seqcst_fences(),
+    thrd_acquire_fences(),
     node_stack(node_stack),
     priv(new struct model_snapshot_members()),
     mo_graph(new CycleGraph())
@@ -127,6 +130,36 @@ static SnapVector<action_list_t> * get_safe_ptr_vect_action(HashTable<void *, Sn
     return tmp;
 }
 
+static struct action_index * get_safe_ptr_index(HashTable<const void *, struct action_index *, uintptr_t, 4> * hash, const void * ptr)
+{
+    struct action_index *tmp = hash->get(ptr);
+    if (tmp == NULL) {
+        tmp = new action_index();
+        hash->put(ptr, tmp);
+    }
+    return tmp;
+}
+
+static bool seq_before(const ModelAction *a, const ModelAction *b)
+{
+    return a->get_seq_number() < b->get_seq_number();
+}
+
+/**
+ * @brief Find the last action before another one in a list of actions
+ * @param list A list of actions, in execution order
+ * @param act The action to search from; need not be in the list
+ * @return The last action in the list which precedes act, or NULL
+ */
+static ModelAction * get_last_before(const SnapVector<ModelAction *> *list, const ModelAction *act)
+{
+    SnapVector<ModelAction *>::const_iterator it;
+    it = std::lower_bound(list->begin(), list->end(), act, seq_before);
+    if (it == list->begin())
+        return NULL;
+    return *(--it);
+}
+
 action_list_t * ModelExecution::get_actions_on_obj(void * obj, thread_id_t tid) const
 {
     SnapVector<action_list_t> *wrv = obj_thrd_map.get(obj);
@@ -151,6 +184,12 @@ unsigned int ModelExecution::get_num_threads() const
     return priv->next_thread_id;
 }
 
+/** @return the sequence number of the most recent ModelAction */
+modelclock_t ModelExecution::get_curr_seq_num() const
+{
+    return priv->used_sequence_numbers;
+}
+
 /** @return a sequence number for a new ModelAction */
 modelclock_t ModelExecution::get_next_seq_num()
 {
@@ -341,49 +380,44 @@ ModelAction * ModelExecution::get_last_fence_conflict(ModelAction *act) const
     if (!last_release)
         return NULL;
 
-    /* Skip past the release */
-    const action_list_t *list = &action_trace;
-    action_list_t::const_reverse_iterator rit;
-    for (rit = list->rbegin(); rit != list->rend(); rit++)
-        if (*rit == last_release)
-            break;
-    ASSERT(rit != list->rend());
-
     /* Find a prior:
      *   load-acquire
      * or
      *   load --sb-> fence-acquire */
-    ModelVector<ModelAction *> acquire_fences(get_num_threads(), NULL);
-    ModelVector<ModelAction *> prior_loads(get_num_threads(), NULL);
-    bool found_acquire_fences = false;
-    for ( ; rit != list->rend(); rit++) {
-        ModelAction *prev = *rit;
-        if (act->same_thread(prev))
+    const struct action_index *index = obj_index.get(act->get_location());
+    int act_tid = id_to_int(act->get_tid());
+    ModelAction *latest_fence = NULL;
+    ModelAction *latest_backtrack = NULL;
+    for (unsigned int i = 0; i < thrd_acquire_fences.size(); i++) {
+        if ((int)i == act_tid)
             continue;
-
-        int tid = id_to_int(prev->get_tid());
-
-        if (prev->is_read() && act->same_var(prev)) {
-            if (prev->is_acquire()) {
-                /* Found most recent load-acquire, don't need
-                 * to search for more fences */
-                if (!found_acquire_fences)
-                    return NULL;
-            } else {
-                prior_loads[tid] = prev;
-            }
-        }
-        if (prev->is_acquire() && prev->is_fence() && !acquire_fences[tid]) {
-            found_acquire_fences = true;
-            acquire_fences[tid] = prev;
-        }
+        ModelAction *fence = get_last_before(&thrd_acquire_fences[i], last_release);
+        if (!fence)
+            continue;
+        if (!latest_fence || *latest_fence < *fence)
+            latest_fence = fence;
+
+        ModelAction *load = NULL;
+        if (i < index->threads.size())
+            load = index->threads[i].first_plain_read;
+        if (load && *load < *last_release)
+            if (!latest_backtrack || *latest_backtrack < *fence)
+                latest_backtrack = fence;
+    }
+
+    /* Any fences preceding the most recent load-acquire don't matter */
+    const SnapVector<ModelAction *> *acquires = &index->acquire_reads;
+    SnapVector<ModelAction *>::const_iterator it;
+    it = std::lower_bound(acquires->begin(), acquires->end(), last_release, seq_before);
+    while (it != acquires->begin()) {
+        ModelAction *load = *(--it);
+        if (act->same_thread(load))
+            continue;
+        if (!latest_fence || *latest_fence < *load)
+            return NULL;
+        break;
     }
 
-    ModelAction *latest_backtrack = NULL;
-    for (unsigned int i = 0; i < acquire_fences.size(); i++)
-        if (acquire_fences[i] && prior_loads[i])
-            if (!latest_backtrack || *latest_backtrack < *acquire_fences[i])
-                latest_backtrack = acquire_fences[i];
     return latest_backtrack;
 }
 
@@ -410,17 +444,24 @@ ModelAction * ModelExecution::get_last_conflict(ModelAction *act) const
     case ATOMIC_RMW: {
         ModelAction *ret = NULL;
 
-        /* linear search: from most recent to oldest */
-        action_list_t *list = obj_map.get(act->get_location());
-        action_list_t::reverse_iterator rit;
-        for (rit = list->rbegin(); rit != list->rend(); rit++) {
-            ModelAction *prev = *rit;
-            if (prev == act)
+        /* The most recent action of each other thread which
+         * could_synchronize_with() act */
+        const struct action_index *index = obj_index.get(act->get_location());
+        bool seqcst_conflict = act->is_seqcst();
+        bool seqcst_any = act->could_be_write() || act->is_fence();
+        bool acquire_conflict = act->is_release() && act->could_be_write();
+        for (unsigned int i = 0; i < index->threads.size(); i++) {
+            if ((int)i == id_to_int(act->get_tid()))
                 continue;
-            if (prev->could_synchronize_with(act)) {
+            const struct thread_index *ti = &index->threads[i];
+            ModelAction *prev = NULL;
+            if (seqcst_conflict)
+                prev = seqcst_any ? ti->last_seqcst : ti->last_seqcst_write;
+            if (acquire_conflict && ti->last_acquire_read)
+                if (!prev || *prev < *ti->last_acquire_read)
+                    prev = ti->last_acquire_read;
+            if (prev && (!ret || *ret < *prev))
                 ret = prev;
-                break;
-            }
         }
 
         ModelAction *ret2 = get_last_fence_conflict(act);
@@ -603,6 +644,35 @@ ModelAction * ModelExecution::get_next_backtrack()
     return next;
 }
 
+/**
+ * @brief Recompute the cached backtracking point after a partial rollback
+ *
+ * Backtracking sets in the (non-snapshotting) NodeStack may have grown since
+ * the snapshot was taken, so the restored value may be stale. Re-examine the
+ * prefix just as a replay from the initial state would have.
+ */
+void ModelExecution::recheck_backtracking()
+{
+    priv->next_backtrack = NULL;
+    for (action_list_t::iterator it = action_trace.begin(); it != action_trace.end(); it++) {
+        /* ATOMIC_UNINIT actions have no Node */
+        if (!(*it)->is_uninitialized())
+            check_curr_backtracking(*it);
+    }
+}
+
+/**
+ * @brief Check if the current state may be snapshotted for partial rollback
+ *
+ * Resolving a promise rewrites the reads-from of earlier ModelActions, which
+ * are not snapshotted, so we only snapshot when no promise is outstanding.
+ * @return True if a later execution may roll back to this point
+ */
+bool ModelExecution::may_snapshot() const
+{
+    return promises.empty() && futurevalues.empty() && !has_asserted();
+}
+
 /**
  * Processes a read model action.
  * @param curr is the read model action to process.
@@ -751,7 +821,7 @@ bool ModelExecution::process_mutex(ModelAction *curr)
         action_list_t *waiters = get_safe_ptr_action(&condvar_waiters_map, curr->get_location());
         int wakeupthread = curr->get_node()->get_misc();
         action_list_t::iterator it = waiters->begin();
-        advance(it, wakeupthread);
+        std::advance(it, wakeupthread);
         scheduler->wake(get_thread(*it));
         waiters->erase(it);
         break;
@@ -1451,6 +1521,7 @@ bool ModelExecution::is_infeasible() const
 ModelAction * ModelExecution::process_rmw(ModelAction *act) {
     ModelAction *lastread = get_last_action(act->get_tid());
     lastread->process_rmw(act);
+    reindex_rmw(lastread);
     if (act->is_rmw()) {
         if (lastread->get_reads_from())
             mo_graph->addRMWEdge(lastread->get_reads_from(), lastread);
@@ -2223,6 +2294,9 @@ void ModelExecution::add_action_to_lists(ModelAction *act)
     int tid = id_to_int(act->get_tid());
     ModelAction *uninit = NULL;
     int uninit_id = -1;
+    /* Overlap the misses of the three lookups of the location */
+    obj_thrd_map.prefetch(act->get_location());
+    obj_index.prefetch(act->get_location());
     action_list_t *list = get_safe_ptr_action(&obj_map, act->get_location());
     if (list->empty() && act->is_atomic_var()) {
         uninit = get_uninitialized_action(act);
@@ -2230,6 +2304,7 @@ void ModelExecution::add_action_to_lists(ModelAction *act)
         list->push_front(uninit);
     }
     list->push_back(act);
+    index_action(act->get_location(), act);
 
     action_trace.push_back(act);
     if (uninit)
@@ -2253,10 +2328,21 @@ void ModelExecution::add_action_to_lists(ModelAction *act)
             thrd_last_fence_release.resize(get_num_threads());
         thrd_last_fence_release[tid] = act;
     }
+    if (act->is_fence() && act->is_seqcst()) {
+        if ((int)thrd_seqcst_fences.size() <= tid)
+            thrd_seqcst_fences.resize(get_num_threads());
+        thrd_seqcst_fences[tid].push_back(act);
+    }
+    if (act->is_fence() && act->is_acquire()) {
+        if ((int)thrd_acquire_fences.size() <= tid)
+            thrd_acquire_fences.resize(get_num_threads());
+        thrd_acquire_fences[tid].push_back(act);
+    }
 
     if (act->is_wait()) {
         void *mutex_loc = (void *) act->get_value();
         get_safe_ptr_action(&obj_map, mutex_loc)->push_back(act);
+        index_action(mutex_loc, act);
 
         SnapVector<action_list_t> *vec = get_safe_ptr_vect_action(&obj_thrd_map, mutex_loc);
         if (tid >= (int)vec->size())
@@ -2265,6 +2351,67 @@ void ModelExecution::add_action_to_lists(ModelAction *act)
     }
 }
 
+/**
+ * @brief Add an action to the indexes over an object's action list
+ *
+ * The uninitialized action is not indexed: it is relaxed and doesn't read, so
+ * none of the get_last_*() queries can return it.
+ *
+ * @param location The object whose list the action was appended to
+ * @param act The action
+ */
+void ModelExecution::index_action(const void *location, ModelAction *act)
+{
+    struct action_index *index = get_safe_ptr_index(&obj_index, location);
+    if (act->is_unlock() || act->is_wait())
+        index->last_unlock = act;
+    /* A wait is listed under its mutex, too, but doesn't access it */
+    if (act->get_location() != location)
+        return;
+
+    if (act->is_write() && act->is_seqcst())
+        index->seqcst_writes.push_back(act);
+    if (act->is_read() && act->is_acquire())
+        index->acquire_reads.push_back(act);
+
+    int tid = id_to_int(act->get_tid());
+    if (tid >= (int)index->threads.size())
+        index->threads.resize(priv->next_thread_id);
+    struct thread_index *ti = &index->threads[tid];
+    if (act->is_rmwr())
+        index->before_rmwr = *ti;
+    if (act->is_seqcst()) {
+        ti->last_seqcst = act;
+        if (act->could_be_write() || act->is_fence())
+            ti->last_seqcst_write = act;
+    }
+    if (act->is_read()) {
+        if (act->is_acquire())
+            ti->last_acquire_read = act;
+        else if (!ti->first_plain_read)
+            ti->first_plain_read = act;
+    }
+}
+
+/**
+ * @brief Update the indexes for a RMWR which was just converted into a RMW or
+ * READ
+ *
+ * The conversion may change the action's type and memory order. Since the RMWR
+ * is still the last action on its object, undo its indexing and index it
+ * anew.
+ *
+ * @param act The converted action
+ */
+void ModelExecution::reindex_rmw(ModelAction *act)
+{
+    struct action_index *index = obj_index.get(act->get_location());
+    if (!index->acquire_reads.empty() && index->acquire_reads.back() == act)
+        index->acquire_reads.pop_back();
+    index->threads[id_to_int(act->get_tid())] = index->before_rmwr;
+    index_action(act->get_location(), act);
+}
+
 /**
  * @brief Get the last action performed by a particular Thread
  * @param tid The thread ID of the Thread in question
@@ -2332,17 +2479,9 @@ ModelAction * ModelExecution::get_last_seq_cst_conflict(ModelAction *curr) const
  */
 ModelAction * ModelExecution::get_last_seq_cst_write(ModelAction *curr) const
 {
-    void *location = curr->get_location();
-    action_list_t *list = obj_map.get(location);
+    const struct action_index *index = obj_index.get(curr->get_location());
     /* Find: max({i in dom(S) | seq_cst(t_i) && isWrite(t_i) && samevar(t_i, t)}) */
-    action_list_t::reverse_iterator rit;
-    for (rit = list->rbegin(); (*rit) != curr; rit++)
-        ;
-    rit++; /* Skip past curr */
-    for ( ; rit != list->rend(); rit++)
-        if ((*rit)->is_write() && (*rit)->is_seqcst())
-            return *rit;
-    return NULL;
+    return get_last_before(&index->seqcst_writes, curr);
 }
 
 /**
@@ -2355,27 +2494,14 @@ ModelAction * ModelExecution::get_last_seq_cst_write(ModelAction *curr) const
  */
 ModelAction * ModelExecution::get_last_seq_cst_fence(thread_id_t tid, const ModelAction *before_fence) const
 {
-    /* All fences should have location FENCE_LOCATION */
-    action_list_t *list = obj_map.get(FENCE_LOCATION);
-
-    if (!list)
+    int thread = id_to_int(tid);
+    if (thread >= (int)thrd_seqcst_fences.size())
         return NULL;
 
-    action_list_t::reverse_iterator rit = list->rbegin();
-
-    if (before_fence) {
-        for (; rit != list->rend(); rit++)
-            if (*rit == before_fence)
-                break;
-
-        ASSERT(*rit == before_fence);
-        rit++;
-    }
-
-    for (; rit != list->rend(); rit++)
-        if ((*rit)->is_fence() && (tid == (*rit)->get_tid()) && (*rit)->is_seqcst())
-            return *rit;
-    return NULL;
+    const SnapVector<ModelAction *> *fences = &thrd_seqcst_fences[thread];
+    if (!before_fence)
+        return fences->empty() ? NULL : fences->back();
+    return get_last_before(fences, before_fence);
 }
 
 /**
@@ -2388,14 +2514,9 @@ ModelAction * ModelExecution::get_last_seq_cst_fence(thread_id_t tid, const Mode
  */
 ModelAction * ModelExecution::get_last_unlock(ModelAction *curr) const
 {
-    void *location = curr->get_location();
-    action_list_t *list = obj_map.get(location);
+    const struct action_index *index = obj_index.get(curr->get_location());
     /* Find: max({i in dom(S) | isUnlock(t_i) && samevar(t_i, t)}) */
-    action_list_t::reverse_iterator rit;
-    for (rit = list->rbegin(); rit != list->rend(); rit++)
-        if ((*rit)->is_unlock() || (*rit)->is_wait())
-            return *rit;
-    return NULL;
+    return index ? index->last_unlock : NULL;
 }
 
 ModelAction * ModelExecution::get_parent_action(thread_id_t tid) const
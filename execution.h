@@ -10,6 +10,7 @@
 
 #include "mymemory.h"
 #include "hashtable.h"
+#include "chunklist.h"
 #include "workqueue.h"
 #include "config.h"
 #include "modeltypes.h"
@@ -30,7 +31,7 @@ struct bug_message;
 
 /** @brief Shorthand for a list of release sequence heads */
 typedef ModelVector<const ModelAction *> rel_heads_list_t;
-typedef SnapList<ModelAction *> action_list_t;
+typedef ChunkList<ModelAction *> action_list_t;
 
 struct PendingFutureValue {
     PendingFutureValue(ModelAction *writer, ModelAction *reader) :
@@ -57,6 +58,41 @@ struct release_seq {
     SnapVector<const ModelAction *> writes;
 };
 
+/** @brief One thread's entries in an action_index */
+struct thread_index {
+    /** @brief The last seq_cst action */
+    ModelAction *last_seqcst;
+    /** @brief The last seq_cst action which may write, or seq_cst fence */
+    ModelAction *last_seqcst_write;
+    /** @brief The last load-acquire */
+    ModelAction *last_acquire_read;
+    /** @brief The first load which is not an acquire */
+    ModelAction *first_plain_read;
+};
+
+/**
+ * @brief Indexes over the action list of a single object (i.e., memory
+ * location)
+ *
+ * Lets the get_last_*() queries find their action without scanning the
+ * object's whole action list.
+ */
+struct action_index {
+    action_index() : last_unlock(NULL) { }
+    /** @brief The seq_cst writes, in execution order */
+    SnapVector<ModelAction *> seqcst_writes;
+    /** @brief The load-acquires, in execution order */
+    SnapVector<ModelAction *> acquire_reads;
+    /** @brief The last unlock or wait */
+    ModelAction *last_unlock;
+    /** @brief Per-thread entries */
+    SnapVector<struct thread_index> threads;
+    /** @brief The entries of the thread of the last RMWR, before the RMWR;
+     *  restored when the RMW completes (see reindex_rmw()) */
+    struct thread_index before_rmwr;
+    SNAPSHOTALLOC
+};
+
 /** @brief The central structure for model-checking */
 class ModelExecution {
 public:
@@ -113,6 +149,9 @@ public:
     bool too_many_steps() const;
 
     ModelAction * get_next_backtrack();
+    void recheck_backtracking();
+    bool may_snapshot() const;
+    modelclock_t get_curr_seq_num() const;
 
     action_list_t * get_action_trace() { return &action_trace; }
 
@@ -178,6 +217,8 @@ private:
 
     void check_curr_backtracking(ModelAction *curr);
     void add_action_to_lists(ModelAction *act);
+    void index_action(const void *location, ModelAction *act);
+    void reindex_rmw(ModelAction *act);
     ModelAction * get_last_fence_release(thread_id_t tid) const;
     ModelAction * get_last_seq_cst_write(ModelAction *curr) const;
     ModelAction * get_last_seq_cst_fence(thread_id_t tid, const ModelAction *before_fence) const;
@@ -209,6 +250,9 @@ private:
 
     HashTable<void *, SnapVector<action_list_t> *, uintptr_t, 4> obj_thrd_map;
 
+    /** Per-object indexes over the lists in obj_map */
+    HashTable<const void *, struct action_index *, uintptr_t, 4> obj_index;
+
     /**
      * @brief List of currently-pending promises
      *
@@ -228,6 +272,10 @@ private:
 
     SnapVector<ModelAction *> thrd_last_action;
     SnapVector<ModelAction *> thrd_last_fence_release;
+    /** Per-thread seq_cst fences, in execution order */
+    SnapVector< SnapVector<ModelAction *> > thrd_seqcst_fences;
+    /** Per-thread fence-acquires, in execution order */
+    SnapVector< SnapVector<ModelAction *> > thrd_acquire_fences;
     NodeStack * const node_stack;
 
     /** A special model-checker Thread; used for associating with
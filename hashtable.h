@@ -1,5 +1,5 @@
 /** @file hashtable.h
- *  @brief Hashtable.  Standard chained bucket variety.
+ *  @brief Hashtable.  Open addressing with grouped probing.
  */
 
 #ifndef __HASHTABLE_H__
@@ -8,9 +8,66 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include "mymemory.h"
 #include "common.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+/** @brief Number of slots whose control bytes are probed at once */
+#define HASHTABLE_GROUP 16
+/** @brief Log2 of the number of mask bits per slot of a group */
+#define HASHTABLE_MASK_SHIFT 0
+
+typedef uint32_t hashtable_mask_t;
+
+/**
+ * @brief Find the control bytes of a group with a given value
+ * @param group The group's control bytes
+ * @param byte The value to look for
+ * @return A mask with bit i set if slot i has the value
+ */
+static inline hashtable_mask_t hashtable_match(const uint8_t *group, uint8_t byte)
+{
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte)));
+}
+
+#else /* !__SSE2__ */
+
+#define HASHTABLE_GROUP 8
+#define HASHTABLE_MASK_SHIFT 3
+
+typedef uint64_t hashtable_mask_t;
+
+/**
+ * @brief Find the control bytes of a group with a given value
+ *
+ * Checks the eight bytes of the group in one 64-bit word. The lowest bit set
+ * is always a match; higher bits may be false positives, which callers must
+ * rule out (by comparing keys) or ignore (by only using the lowest bit).
+ *
+ * @param group The group's control bytes
+ * @param byte The value to look for
+ * @return A mask with bit 8*i+7 set if slot i has the value
+ */
+static inline hashtable_mask_t hashtable_match(const uint8_t *group, uint8_t byte)
+{
+    uint64_t word;
+    memcpy(&word, group, sizeof(word));
+    word ^= 0x0101010101010101ULL * byte;
+    return (word - 0x0101010101010101ULL) & ~word & 0x8080808080808080ULL;
+}
+
+#endif /* !__SSE2__ */
+
+/** @brief The slot of the lowest bit set in a hashtable_match() mask */
+static inline unsigned int hashtable_first(hashtable_mask_t mask)
+{
+    return __builtin_ctzll(mask) >> HASHTABLE_MASK_SHIFT;
+}
+
 /**
  * @brief HashTable node
  *
@@ -31,11 +88,17 @@ struct hashlistnode {
  * a key and is designed primarily with pointer-based keys in mind. Other
  * primitive key types are supported only for non-zero values.
  *
+ * Each slot has a control byte: 0 if the slot is empty, otherwise 0x80 plus 7
+ * bits of the key's hash. Lookups compare the control bytes of a whole group
+ * of slots at once (with SSE2 where available), and only compare the keys of
+ * the slots whose hash bits match. Groups are probed quadratically.
+ *
  * @tparam _Key    Type name for the key
  * @tparam _Val    Type name for the values to be stored
  * @tparam _KeyInt Integer type that is at least as large as _Key. Used for key
  *                 manipulation and storage.
- * @tparam _Shift  Logical shift to apply to all keys. Default 0.
+ * @tparam _Shift  Logical shift to apply to all keys before hashing them.
+ *                 Default 0.
  * @tparam _malloc Provide your own 'malloc' for the table, or default to
  *                 snapshotting.
  * @tparam _calloc Provide your own 'calloc' for the table, or default to
@@ -48,19 +111,16 @@ class HashTable {
  public:
     /**
      * @brief Hash table constructor
-     * @param initialcapacity Sets the initial capacity of the hash table.
-     * Default size 1024.
+     * @param initialcapacity Sets the initial capacity of the hash table; a
+     * power of 2. Default size 1024.
      * @param factor Sets the percentage full before the hashtable is
-     * resized. Default ratio 0.5.
+     * resized. Default ratio 0.875.
      */
-    HashTable(unsigned int initialcapacity = 1024, double factor = 0.5) {
-        // Allocate space for the hash table
-        table = (struct hashlistnode<_Key, _Val> *)_calloc(initialcapacity, sizeof(struct hashlistnode<_Key, _Val>));
+    HashTable(unsigned int initialcapacity = 1024, double factor = 0.875) {
+        if (initialcapacity < HASHTABLE_GROUP)
+            initialcapacity = HASHTABLE_GROUP;
         loadfactor = factor;
-        capacity = initialcapacity;
-        capacitymask = initialcapacity - 1;
-
-        threshold = (unsigned int)(initialcapacity * loadfactor);
+        allocate(initialcapacity);
         size = 0; // Initial number of elements in the hash
     }
 
@@ -91,7 +151,7 @@ class HashTable {
 
     /** @brief Reset the table to its initial state. */
     void reset() {
-        memset(table, 0, capacity * sizeof(struct hashlistnode<_Key, _Val>));
+        memset(ctrl, 0, capacity);
         size = 0;
     }
 
@@ -107,22 +167,30 @@ class HashTable {
         if (size > threshold)
             resize(capacity << 1);
 
-        struct hashlistnode<_Key, _Val> *search;
-
-        unsigned int index = ((_KeyInt)key) >> _Shift;
-        do {
-            index &= capacitymask;
-            search = &table[index];
-            if (search->key == key) {
-                search->val = val;
+        uint64_t h = hash(key);
+        uint8_t tag = hash_tag(h);
+        unsigned int group = h & groupmask;
+        for (unsigned int step = 1; ; step++) {
+            const uint8_t *groupctrl = &ctrl[group * HASHTABLE_GROUP];
+            for (hashtable_mask_t m = hashtable_match(groupctrl, tag); m; m &= m - 1) {
+                struct hashlistnode<_Key, _Val> *search = &table[group * HASHTABLE_GROUP + hashtable_first(m)];
+                if (search->key == key) {
+                    search->val = val;
+                    return;
+                }
+            }
+            /* Without removals, the key cannot be in a later group */
+            hashtable_mask_t empty = hashtable_match(groupctrl, 0);
+            if (empty) {
+                unsigned int index = group * HASHTABLE_GROUP + hashtable_first(empty);
+                ctrl[index] = tag;
+                table[index].key = key;
+                table[index].val = val;
+                size++;
                 return;
             }
-            index++;
-        } while (search->key);
-
-        search->key = key;
-        search->val = val;
-        size++;
+            group = (group + step) & groupmask;
+        }
     }
 
     /**
@@ -131,20 +199,8 @@ class HashTable {
      * @return The value in the table, if the key is found; otherwise 0
      */
     _Val get(_Key key) const {
-        struct hashlistnode<_Key, _Val> *search;
-
-        /* HashTable cannot handle 0 as a key */
-        ASSERT(key);
-
-        unsigned int index = ((_KeyInt)key) >> _Shift;
-        do {
-            index &= capacitymask;
-            search = &table[index];
-            if (search->key == key)
-                return search->val;
-            index++;
-        } while (search->key);
-        return (_Val)0;
+        struct hashlistnode<_Key, _Val> *search = find(key);
+        return search ? search->val : (_Val)0;
     }
 
     /**
@@ -153,68 +209,111 @@ class HashTable {
      * @return True, if the key is found; false otherwise
      */
     bool contains(_Key key) const {
-        struct hashlistnode<_Key, _Val> *search;
-
-        /* HashTable cannot handle 0 as a key */
-        ASSERT(key);
+        return find(key) != NULL;
+    }
 
-        unsigned int index = ((_KeyInt)key) >> _Shift;
-        do {
-            index &= capacitymask;
-            search = &table[index];
-            if (search->key == key)
-                return true;
-            index++;
-        } while (search->key);
-        return false;
+    /**
+     * @brief Start loading the memory that looking up a key will touch
+     *
+     * Call a few keys (HASHTABLE_PREFETCH_DISTANCE) ahead when looking up
+     * many keys in a row, so that the cache misses of the lookups overlap.
+     *
+     * @param key The key to look up later
+     */
+    void prefetch(_Key key) const {
+        uint64_t h = hash(key);
+        unsigned int group = h & groupmask;
+        __builtin_prefetch(&ctrl[group * HASHTABLE_GROUP]);
+        __builtin_prefetch(&table[group * HASHTABLE_GROUP]);
     }
 
     /**
      * @brief Resize the table
-     * @param newsize The new size of the table
+     * @param newsize The new size of the table; a power of 2
      */
     void resize(unsigned int newsize) {
         struct hashlistnode<_Key, _Val> *oldtable = table;
-        struct hashlistnode<_Key, _Val> *newtable;
+        uint8_t *oldctrl = ctrl;
         unsigned int oldcapacity = capacity;
 
-        if ((newtable = (struct hashlistnode<_Key, _Val> *)_calloc(newsize, sizeof(struct hashlistnode<_Key, _Val>))) == NULL) {
-            model_print("calloc error %s %d\n", __FILE__, __LINE__);
-            exit(EXIT_FAILURE);
+        allocate(newsize);
+
+        for (unsigned int i = 0; i < oldcapacity; i++) {
+            if (!oldctrl[i])
+                continue;
+            uint64_t h = hash(oldtable[i].key);
+            unsigned int group = h & groupmask;
+            for (unsigned int step = 1; ; step++) {
+                hashtable_mask_t empty = hashtable_match(&ctrl[group * HASHTABLE_GROUP], 0);
+                if (empty) {
+                    unsigned int index = group * HASHTABLE_GROUP + hashtable_first(empty);
+                    ctrl[index] = oldctrl[i];
+                    table[index] = oldtable[i];
+                    break;
+                }
+                group = (group + step) & groupmask;
+            }
         }
 
-        table = newtable;          // Update the global hashtable upon resize()
-        capacity = newsize;
-        capacitymask = newsize - 1;
+        _free(oldtable);            // Free the memory of the old hash table
+    }
 
-        threshold = (unsigned int)(newsize * loadfactor);
+ private:
+    /** @brief Hash a key, scattering the (aligned) pointer bits */
+    static uint64_t hash(_Key key) {
+        uint64_t h = ((uint64_t)(_KeyInt)key >> _Shift) * 0x9E3779B97F4A7C15ULL;
+        return h ^ (h >> 32);
+    }
 
-        struct hashlistnode<_Key, _Val> *bin = &oldtable[0];
-        struct hashlistnode<_Key, _Val> *lastbin = &oldtable[oldcapacity];
-        for (; bin < lastbin; bin++) {
-            _Key key = bin->key;
+    /** @brief The control byte of a slot holding a key with a given hash */
+    static uint8_t hash_tag(uint64_t h) {
+        return 0x80 | (h >> 57);
+    }
 
-            struct hashlistnode<_Key, _Val> *search;
+    /**
+     * @brief Allocate an empty table, with the control bytes behind the slots
+     * @param newsize The number of slots
+     */
+    void allocate(unsigned int newsize) {
+        size_t bytes = newsize * (sizeof(struct hashlistnode<_Key, _Val>) + 1);
+        if ((table = (struct hashlistnode<_Key, _Val> *)_calloc(1, bytes)) == NULL) {
+            model_print("calloc error %s %d\n", __FILE__, __LINE__);
+            exit(EXIT_FAILURE);
+        }
+        ctrl = (uint8_t *)&table[newsize];
+        capacity = newsize;
+        groupmask = newsize / HASHTABLE_GROUP - 1;
+        threshold = (unsigned int)(newsize * loadfactor);
+    }
 
-            unsigned int index = ((_KeyInt)key) >> _Shift;
-            do {
-                index &= capacitymask;
-                search = &table[index];
-                index++;
-            } while (search->key);
+    /** @return The slot holding a key, or NULL if none */
+    struct hashlistnode<_Key, _Val> * find(_Key key) const {
+        /* HashTable cannot handle 0 as a key */
+        ASSERT(key);
 
-            search->key = key;
-            search->val = bin->val;
+        uint64_t h = hash(key);
+        uint8_t tag = hash_tag(h);
+        unsigned int group = h & groupmask;
+        for (unsigned int step = 1; ; step++) {
+            const uint8_t *groupctrl = &ctrl[group * HASHTABLE_GROUP];
+            for (hashtable_mask_t m = hashtable_match(groupctrl, tag); m; m &= m - 1) {
+                struct hashlistnode<_Key, _Val> *search = &table[group * HASHTABLE_GROUP + hashtable_first(m)];
+                if (search->key == key)
+                    return search;
+            }
+            if (hashtable_match(groupctrl, 0))
+                return NULL;
+            group = (group + step) & groupmask;
         }
-
-        _free(oldtable);            // Free the memory of the old hash table
     }
 
- private:
     struct hashlistnode<_Key, _Val> *table;
+    /** @brief One control byte per slot; see HashTable */
+    uint8_t *ctrl;
     unsigned int capacity;
     unsigned int size;
-    unsigned int capacitymask;
+    /** @brief The number of groups, minus one */
+    unsigned int groupmask;
     unsigned int threshold;
     double loadfactor;
 };
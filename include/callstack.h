@@ -14,12 +14,15 @@
 #pragma once
 
 #include "common.h"
+#include "hashtable.h"
+#include "stl-model.h"
 #include "model-assert.h"
 
 #include <cstring>
 #include <sstream>
 
 #include <cxxabi.h>
+#include <execinfo.h>
 #include <stdio.h>
 #include <unistd.h>
 
@@ -30,87 +33,137 @@ namespace cdschecker {
 
 
 // For a good stack avoid local static funcs & skip frames
+//
+// Only the raw program counters are recorded at construction time; they are
+// symbolized (which is expensive) only when the callstack is printed. All
+// callstacks share one libbacktrace state, and each unique program counter
+// is resolved only once.
 class callstack
 {
 public:
 
-    callstack()
+    explicit callstack(bool capture = true)
     {
-        collect();
+        if (capture) {
+            collect();
+        }
     }
 
-    ~callstack()                           = default; // leaks _btstate?
+    ~callstack()                           = default;
     callstack(const callstack&)            = default;
     callstack& operator=(const callstack&) = default;
     callstack(callstack&&)                 = default;
     callstack& operator=(callstack&&)      = default;
 
+    // Create the process-wide backtrace state; call once at startup
+    static void init()
+    {
+        switch_alloc = 1; 
+        btstate();
+        switch_alloc = 0;
+    }
+
     void print(int fd) const
     {
+        if (_depth == 0) {
+            return;
+        }
+
         switch_alloc = 1; 
-        dprintf(fd, "%s", _buf);
+        for (int i = 0; i < _depth; ++i) {
+            // Return addresses point past the call instruction
+            uintptr_t pc = reinterpret_cast<uintptr_t>(_pcs[i]) - 1;
+            const frame_list* frames = symbolize(pc);
+            for (unsigned int f = 0; f < frames->size(); ++f) {
+                const frame& fr = (*frames)[f];
+                if (fr.filename) {
+                    dprintf(fd, "%s:%d  %s\n", fr.filename, fr.linenum, fr.function);
+                } else {
+                    dprintf(fd, "%s\n", fr.function);
+                }
+            }
+        }
+        dprintf(fd, "\n");
         switch_alloc = 0;
     }
 
 private:
 
+    // One source location of a program counter; several for inlined calls.
+    // An error message is stored as a function with no file name.
+    struct frame {
+        const char* filename;
+        int         linenum;
+        const char* function;
+    };
+
+    typedef ModelVector<frame> frame_list;
+    typedef HashTable<uintptr_t, frame_list*, uintptr_t, 0, model_malloc, model_calloc, model_free> frame_cache;
+
     void collect()
     {
-        _btstate = backtrace_create_state(nullptr, BACKTRACE_SUPPORTS_THREADS, error_callback, nullptr);
-        
-        // For a good stack avoid local static funcs & skip frames
-        backtrace_full(_btstate, 0, full_callback, error_callback, this); 
-        if (_bufUsed < _BUFSZ) {
-            _bufUsed += snprintf(_buf+_bufUsed, _BUFSZ-_bufUsed, "\n");
-        }
+        // backtrace() may allocate when first called
+        switch_alloc = 1; 
+        _depth = ::backtrace(_pcs, _MAXFRAMES);
+        switch_alloc = 0;
     }
 
-    static void error_callback (void *data, const char *message, int errnum) 
+    static struct backtrace_state* btstate()
     {
-        callstack* cstk(reinterpret_cast<callstack*>(data));
-        MODEL_ASSERT(cstk);
+        static struct backtrace_state* state = backtrace_create_state(nullptr, BACKTRACE_SUPPORTS_THREADS, create_error_callback, nullptr);
+        return state;
+    }
 
-        int n{0};
-        if (errnum == -1) {
-            n = snprintf(cstk->_buf+cstk->_bufUsed, cstk->_BUFSZ-cstk->_bufUsed, 
-                         "If you want backtraces, you have to compile with -g\n");
-        } else {
-            n = snprintf(cstk->_buf+cstk->_bufUsed, cstk->_BUFSZ-cstk->_bufUsed,
-                        "Backtrace error %d: %s\n", errnum, (message ? message : ""));
-        };
-        if (n >= 0) {
-            cstk->_bufUsed += n;
-            MODEL_ASSERT(cstk->_bufUsed <= cstk->_BUFSZ);
+    static const frame_list* symbolize(uintptr_t pc)
+    {
+        static frame_cache* cache = new frame_cache();
+
+        frame_list* frames = cache->get(pc);
+        if ( ! frames) {
+            frames = new frame_list();
+            backtrace_pcinfo(btstate(), pc, full_callback, error_callback, frames);
+            cache->put(pc, frames);
         }
+        return frames;
     }
 
-    static void syminfo_callback (void *data, uintptr_t pc, const char *symname, uintptr_t symval, uintptr_t symsize) 
+    // Copy a string into the model-checker heap, which the cache lives in
+    static const char* keep(const char* str)
     {
-        callstack* cstk(reinterpret_cast<callstack*>(data));
-        MODEL_ASSERT(cstk);
+        int old = switch_alloc;
+        switch_alloc = 1;
+        char* copy = strdup(str);
+        switch_alloc = old;
+        return copy;
+    }
+
+    static void create_error_callback (void *data, const char *message, int errnum) 
+    {
+        model_print("Backtrace error %d: %s\n", errnum, (message ? message : ""));
+    }
 
-        int n{0};
-        n = snprintf(cstk->_buf+cstk->_bufUsed, cstk->_BUFSZ-cstk->_bufUsed, 
-                        "%lx %s ??:0\n", (unsigned long)pc, symname ? symname : "???");
+    static void error_callback (void *data, const char *message, int errnum) 
+    {
+        frame_list* frames(reinterpret_cast<frame_list*>(data));
+        MODEL_ASSERT(frames);
 
-        if (n >= 0) {
-            cstk->_bufUsed += n;
-            MODEL_ASSERT(cstk->_bufUsed <= cstk->_BUFSZ);
+        char msg[256];
+        if (errnum == -1) {
+            snprintf(msg, sizeof(msg), "If you want backtraces, you have to compile with -g");
+        } else {
+            snprintf(msg, sizeof(msg), "Backtrace error %d: %s", errnum, (message ? message : ""));
         }
+        frames->push_back(frame{nullptr, 0, keep(msg)});
     }
 
     static int full_callback (void *data, uintptr_t pc, const char *pathname, int linenum, const char *function) 
     {
-        callstack* cstk(reinterpret_cast<callstack*>(data));
-        MODEL_ASSERT(cstk);
-
-#if 0
-        if ( ! function) {
-            backtrace_syminfo(cstk->_btstate, pc, syminfo_callback, error_callback, data);
-            return 0;
-        }
-#endif
+        frame_list* frames(reinterpret_cast<frame_list*>(data));
+        MODEL_ASSERT(frames);
 
+        // pathname and function may become invalid after we return, and
+        // __cxa_demangle() reallocs its buffer in the (snapshotted) user heap,
+        // so the cache keeps its own copies of all of them
         const char *filename = rindex(pathname ? pathname : "", '/');
         if (filename) {
             ++filename; 
@@ -120,27 +173,24 @@ private:
         
         int   rval{0};
         char* dfunc(abi::__cxa_demangle(function ? function : "", nullptr, nullptr, &rval));
-        const char *fname = rval == 0 ? dfunc : function;
+        const char *fname = keep(rval == 0 ? dfunc : (function ? function : "(null)"));
+        if (dfunc) {
+            int old = switch_alloc;
+            switch_alloc = 0;
+            free(dfunc);
+            switch_alloc = old;
+        }
         
-        int n{0};
-        n = snprintf(cstk->_buf+cstk->_bufUsed, cstk->_BUFSZ-cstk->_bufUsed,
-                     "%s:%d  %s\n", filename, linenum, fname);
-
-      if (n >= 0) {
-          cstk->_bufUsed += n;
-          MODEL_ASSERT(cstk->_bufUsed <= cstk->_BUFSZ);
-      }
+        frames->push_back(frame{keep(filename), linenum, fname});
     
-      return 0;
+        return 0;
     }
 
 private:
 
-    struct backtrace_state* _btstate{nullptr}; //TODO: leaks?
-    
-    static constexpr int _BUFSZ = 4096;
-    char                 _buf[_BUFSZ+1] = {0};
-    int                  _bufUsed{0};
+    static constexpr int _MAXFRAMES = 24;
+    void*                _pcs[_MAXFRAMES];
+    int                  _depth{0};
 
 }; // callstack
 
@@ -5,6 +5,7 @@
 #ifndef __LIBRACE_H__
 #define __LIBRACE_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -21,6 +22,14 @@ extern "C" {
     uint32_t load_32(const void *addr);
     uint64_t load_64(const void *addr);
 
+    /* Check a whole buffer (array, struct) at once, rather than byte by byte */
+    void store_range(void *addr, size_t size);
+    void load_range(const void *addr, size_t size);
+
+    /* memcpy() and memset(), checked for data races */
+    void * race_memcpy(void *dst, const void *src, size_t size);
+    void * race_memset(void *dst, int c, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -73,6 +73,39 @@ void store(T* addr, T val, typename std::enable_if<(sizeof(T) == 8), bool>::type
 }
 
 
+/*
+ * Check whole objects (arrays, structs) for data races, as if accessed by
+ * memcpy()/memset(); one call per object instead of one per byte.
+ * Usage:
+ *   char buf[4096];
+ *   librace::load_range(buf);           // read all of buf
+ *   librace::store_range(buf);          // write all of buf
+ *   librace::copy(dst, src);            // dst = src; src and dst of the same type
+ *   librace::fill(buf, 0);              // memset(buf, 0, sizeof(buf))
+ */
+template <typename T>
+void load_range(const T& obj) {
+    ::load_range(&obj, sizeof(T));
+}
+
+template <typename T>
+void store_range(T& obj) {
+    ::store_range(&obj, sizeof(T));
+}
+
+template <typename T>
+void copy(T& dst, const T& src) {
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+    race_memcpy(&dst, &src, sizeof(T));
+}
+
+template <typename T>
+void fill(T& obj, int c) {
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+    race_memset(&obj, c, sizeof(T));
+}
+
+
 /*
  * Check fundamental types for data races.
  * Usage:
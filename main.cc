@@ -10,6 +10,8 @@
 #include "output.h"
 
 #include "datarace.h"
+#include "clockvector.h"
+#include "threads-model.h"
 
 /* global "model" object */
 #include "model.h"
@@ -17,6 +19,9 @@
 #include "snapshot-interface.h"
 #include "scanalysis.h"
 #include "plugins.h"
+#include "callstack.h"
+#include "parallel.h"
+#include "asyncanalysis.h"
 
 static void param_defaults(struct model_params *params)
 {
@@ -32,6 +37,14 @@ static void param_defaults(struct model_params *params)
     params->verbose = !!DBG_ENABLED();
     params->uninitvalue = 0;
     params->maxexecutions = 0;
+    params->snapshotinterval = 4;
+    params->backingpages = 10000;
+    params->numsnapshots = 1024;
+    params->snapshotregions = 1024;
+    params->heappages = 4000;
+    params->callstacks = true;
+    params->jobs = 1;
+    params->analysisjobs = 0;
 }
 
 static void print_usage(const char *program_name, struct model_params *params)
@@ -89,6 +102,37 @@ static void print_usage(const char *program_name, struct model_params *params)
 "-x, --maxexec=NUM           Maximum number of executions.\n"
 "                            Default: %u\n"
 "                            -o help for a list of options\n"
+"-p, --snapshotinterval=NUM  Take a snapshot every NUM steps, so that the next\n"
+"                              execution rolls back to the divergence point\n"
+"                              instead of replaying from the start.\n"
+"                              0 disables partial rollback, as do analysis\n"
+"                              plugins other than SC.\n"
+"                              Default: %u\n"
+"-B, --backingpages=NUM      Number of pages initially reserved for saving\n"
+"                              snapshotted memory; grows as needed.\n"
+"                              Default: %u\n"
+"-N, --snapshots=NUM         Number of snapshots initially reserved; grows as\n"
+"                              needed.\n"
+"                              Default: %u\n"
+"-R, --regions=NUM           Maximum number of memory regions to snapshot.\n"
+"                              Default: %u\n"
+"-H, --heappages=NUM         Size in pages of the user program's (and the model\n"
+"                              checker's) snapshotting heap.\n"
+"                              Default: %u\n"
+"-k, --nocallstacks          Do not record the callstack of each action; bug\n"
+"                              reports will not show where actions came from.\n"
+"                              Default: %s\n"
+"-j, --jobs=NUM              Explore executions with NUM worker processes.\n"
+"                              Not supported with analysis plugins. Execution\n"
+"                              counts, buggy ones included, may slightly exceed\n"
+"                              a single job's, and a bug may be reported again.\n"
+"                              Default: %u\n"
+"-A, --analysisjobs=NUM      Run the trace analyses of up to NUM executions at\n"
+"                              once in forked processes, while exploring further\n"
+"                              executions. Only for plugins supporting it (SC);\n"
+"                              their output may come after later executions'.\n"
+"                              0 runs all trace analyses in line.\n"
+"                              Default: %u\n"
 " --                         Program arguments follow.\n\n",
         program_name,
         params->maxreads,
@@ -102,7 +146,15 @@ static void print_usage(const char *program_name, struct model_params *params)
         params->bound,
         params->verbose,
     params->uninitvalue,
-        params->maxexecutions);
+        params->maxexecutions,
+        params->snapshotinterval,
+        params->backingpages,
+        params->numsnapshots,
+        params->snapshotregions,
+        params->heappages,
+        params->callstacks ? "callstacks enabled" : "callstacks disabled",
+        params->jobs,
+        params->analysisjobs);
     model_print("Analysis plugins:\n");
     for(unsigned int i=0;i<registeredanalysis->size();i++) {
         TraceAnalysis * analysis=(*registeredanalysis)[i];
@@ -126,9 +178,14 @@ bool install_plugin(char * name) {
     return true;
 }
 
-static void parse_options(struct model_params *params, int argc, char **argv)
+/**
+ * @brief Parse the model-checker options
+ * @param early Only pick up the snapshot system's limits, which are needed
+ * before anything else (including the analysis plugins) can be set up
+ */
+static void parse_options(struct model_params *params, int argc, char **argv, bool early)
 {
-    const char *shortopts = "hyYt:o:m:M:s:S:f:e:b:u:x:v::";
+    const char *shortopts = "hyYkt:o:m:M:s:S:f:e:b:u:x:p:j:A:B:N:R:H:v::";
     const struct option longopts[] = {
         {"help", no_argument, NULL, 'h'},
         {"liveness", required_argument, NULL, 'm'},
@@ -145,11 +202,23 @@ static void parse_options(struct model_params *params, int argc, char **argv)
         {"analysis", required_argument, NULL, 't'},
         {"options", required_argument, NULL, 'o'},
         {"maxexecutions", required_argument, NULL, 'x'},
+        {"snapshotinterval", required_argument, NULL, 'p'},
+        {"nocallstacks", no_argument, NULL, 'k'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"analysisjobs", required_argument, NULL, 'A'},
+        {"backingpages", required_argument, NULL, 'B'},
+        {"snapshots", required_argument, NULL, 'N'},
+        {"regions", required_argument, NULL, 'R'},
+        {"heappages", required_argument, NULL, 'H'},
         {0, 0, 0, 0} /* Terminator */
     };
     int opt, longindex;
     bool error = false;
+    /* Leave reporting bad options to the full pass */
+    opterr = !early;
     while (!error && (opt = getopt_long(argc, argv, shortopts, longopts, &longindex)) != -1) {
+        if (early && opt != 'B' && opt != 'N' && opt != 'R' && opt != 'H')
+            continue;
         switch (opt) {
         case 'h':
             print_usage(argv[0], params);
@@ -157,6 +226,27 @@ static void parse_options(struct model_params *params, int argc, char **argv)
         case 'x':
             params->maxexecutions = atoi(optarg);
             break;
+        case 'p':
+            params->snapshotinterval = atoi(optarg);
+            break;
+        case 'j':
+            params->jobs = atoi(optarg);
+            break;
+        case 'A':
+            params->analysisjobs = atoi(optarg);
+            break;
+        case 'B':
+            params->backingpages = atoi(optarg);
+            break;
+        case 'N':
+            params->numsnapshots = atoi(optarg);
+            break;
+        case 'R':
+            params->snapshotregions = atoi(optarg);
+            break;
+        case 'H':
+            params->heappages = atoi(optarg);
+            break;
         case 's':
             params->maxfuturedelay = atoi(optarg);
             break;
@@ -201,12 +291,21 @@ static void parse_options(struct model_params *params, int argc, char **argv)
         case 'Y':
             params->yieldblock = true;
             break;
+        case 'k':
+            params->callstacks = false;
+            break;
         default: /* '?' */
             error = true;
             break;
         }
     }
 
+    if (early) {
+        optind = 1;
+        opterr = 1;
+        return;
+    }
+
     /* Pass remaining arguments to user program */
     params->argc = argc - (optind - 1);
     params->argv = argv + (optind - 1);
@@ -244,11 +343,43 @@ static void model_main()
     param_defaults(&params);
     register_plugins();
 
-    parse_options(&params, main_argc, main_argv);
+    parse_options(&params, main_argc, main_argv, false);
+
+    if (params.callstacks)
+        cdschecker::callstack::init();
+
+    if (params.jobs > 1) {
+#if USE_MPROTECT_SNAPSHOT
+        if (getInstalledTraceAnalysis()->size() > 0) {
+            model_print("Analysis plugins do not support --jobs; running a single job\n");
+            params.jobs = 1;
+        }
+#else
+        model_print("Fork-based snapshotting does not support --jobs; running a single job\n");
+        params.jobs = 1;
+#endif
+        parallel_init(params.jobs);
+    }
+
+    /* Resuming executions share a trace prefix, which not every analysis handles */
+    ModelVector<TraceAnalysis *> *analyses = getInstalledTraceAnalysis();
+    for (unsigned int i = 0; i < analyses->size(); i++)
+        if (!(*analyses)[i]->canRollBackPartially())
+            params.snapshotinterval = 0;
+
+#if USE_MPROTECT_SNAPSHOT
+    async_analysis_init(params.analysisjobs);
+#else
+    if (params.analysisjobs > 0)
+        model_print("Fork-based snapshotting does not support --analysisjobs; running trace analyses in line\n");
+#endif
 
     //Initialize race detector
     initRaceDetector();
 
+    ClockVector::init_pool();
+    stack_pool_init();
+
     snapshot_stack_init();
 
     model = new ModelChecker(params);
@@ -285,6 +416,11 @@ int main(int argc, char **argv)
     /* Configure output redirection for the model-checker */
     redirect_output();
 
+    struct model_params params;
+    param_defaults(&params);
+    parse_options(&params, argc, argv, true);
+
     /* Let's jump in quickly and start running stuff */
-    snapshot_system_init(10000, 1024, 1024, 4000, &model_main);
+    snapshot_system_init(params.backingpages, params.numsnapshots,
+            params.snapshotregions, params.heappages, &model_main);
 }
@@ -16,21 +16,55 @@
 #include "traceanalysis.h"
 #include "execution.h"
 #include "bugmessage.h"
+#include "parallel.h"
+#include "asyncanalysis.h"
 
 ModelChecker *model;
 
+/**
+ * @brief Model-checker state saved alongside a mid-execution snapshot
+ *
+ * ModelActions are not snapshotted, and the pending (not yet explored)
+ * action of each thread is consumed by later steps, so we keep pristine
+ * copies to hand back to the threads when rolling back to this point.
+ */
+struct rollback_point {
+    rollback_point(modelclock_t step, unsigned int num_threads) :
+        step(step),
+        pending(num_threads, NULL),
+        output_len(0)
+    { }
+
+    ~rollback_point() {
+        for (unsigned int i = 0; i < pending.size(); i++)
+            delete pending[i];
+    }
+
+    /** @brief Number of ModelActions explored when the snapshot was taken */
+    modelclock_t step;
+    /** @brief Copies of each thread's pending ModelAction (or NULL) */
+    ModelVector<ModelAction *> pending;
+    /** @brief Length of the stashed program output at the snapshot */
+    size_t output_len;
+
+    MEMALLOC
+};
+
 /** @brief Constructor */
 ModelChecker::ModelChecker(struct model_params params) :
     /* Initialize default scheduler */
     params(params),
     restart_flag(false),
     exit_flag(false),
+    unclaimed_execution(false),
     scheduler(new Scheduler()),
     node_stack(new NodeStack()),
     execution(new ModelExecution(this, &this->params, scheduler, node_stack)),
     execution_number(1),
     diverge(NULL),
     earliest_diverge(NULL),
+    rollback_points(),
+    branch(NULL),
     trace_analyses(),
     inspect_plugin(NULL)
 {
@@ -40,28 +74,89 @@ ModelChecker::ModelChecker(struct model_params params) :
 /** @brief Destructor */
 ModelChecker::~ModelChecker()
 {
+    for (unsigned int i = 0; i < rollback_points.size(); i++)
+        delete rollback_points[i];
+    model_free(branch);
     delete node_stack;
     delete scheduler;
 }
 
 /**
- * Restores user program to initial state and resets all model-checker data
- * structures.
+ * Restores user program to the latest snapshot preceding the divergence point
+ * (or to the initial state, if there is none) and resets all model-checker
+ * data structures accordingly.
  */
 void ModelChecker::reset_to_initial_state()
 {
     DEBUG("+++ Resetting to initial state +++\n");
-    node_stack->reset_execution();
 
-    /**
-     * FIXME: if we utilize partial rollback, we will need to free only
-     * those pending actions which were NOT pending before the rollback
-     * point
+    /*
+     * Pending actions are never shared with a rollback point; the threads
+     * get fresh copies of the rollback point's actions below
      */
     for (unsigned int i = 0; i < get_num_threads(); i++)
         delete get_thread(int_to_id(i))->get_pending();
 
-    snapshot_backtrack_before(0);
+    /* The divergence point itself must be re-executed */
+    modelclock_t step = snapshot_backtrack_before(diverge ? diverge->get_seq_number() - 1 : 0);
+    while (!rollback_points.empty() && rollback_points.back()->step > step) {
+        delete rollback_points.back();
+        rollback_points.pop_back();
+    }
+    node_stack->reset_execution(step);
+
+    if (step == 0) {
+        rollback_program_output(0);
+        return;
+    }
+
+    DEBUG("+++ Partial rollback to step %u +++\n", step);
+    struct rollback_point *point = rollback_points.back();
+    ASSERT(point->step == step);
+    for (unsigned int i = 0; i < get_num_threads(); i++) {
+        Thread *thr = get_thread(int_to_id(i));
+        if (thr->get_pending())
+            thr->set_pending(new ModelAction(*point->pending[i]));
+    }
+    rollback_program_output(point->output_len);
+    execution->recheck_backtracking();
+}
+
+/**
+ * @brief Take a mid-execution snapshot for partial rollback, if appropriate
+ *
+ * Must be called at a free scheduling point (i.e., no thread is forced to
+ * take the next step), with every runnable thread's next action pending.
+ */
+void ModelChecker::record_rollback_point()
+{
+    /* Plugins may need to inspect every action of every execution */
+    if (params.snapshotinterval == 0 || inspect_plugin)
+        return;
+
+    modelclock_t step = execution->get_curr_seq_num();
+    modelclock_t last = rollback_points.empty() ? 0 : rollback_points.back()->step;
+    if (step < last + params.snapshotinterval ||
+            rollback_points.size() >= MAX_ROLLBACK_POINTS ||
+            !execution->may_snapshot() || !snapshot_has_headroom())
+        return;
+
+    struct rollback_point *point = new rollback_point(step, get_num_threads());
+    for (unsigned int i = 0; i < get_num_threads(); i++) {
+        ModelAction *pending = get_thread(int_to_id(i))->get_pending();
+        if (pending)
+            point->pending[i] = new ModelAction(*pending);
+    }
+    point->output_len = stash_program_output();
+    rollback_points.push_back(point);
+
+    IN_TRACE_ANALYSIS = true;
+    for (unsigned int i = 0; i < trace_analyses.size(); i++)
+        trace_analyses[i]->analyzePrefix(execution->get_action_trace());
+    IN_TRACE_ANALYSIS = false;
+
+    DEBUG("+++ Snapshot at step %u +++\n", step);
+    snapshot_record(step);
 }
 
 /** @return the number of user threads created during this execution */
@@ -100,8 +195,11 @@ Thread * ModelChecker::get_next_thread()
      * Have we completed exploring the preselected path? Then let the
      * scheduler decide
      */
-    if (diverge == NULL)
+    if (diverge == NULL) {
+        if (node_stack->get_replay())
+            return get_replay_thread();
         return scheduler->select_next_thread(node_stack->get_head());
+    }
 
 
     /* Else, we are trying to replay an execution */
@@ -116,10 +214,12 @@ Thread * ModelChecker::get_next_thread()
         scheduler->update_sleep_set(prevnode);
 
         /* Reached divergence point */
+        uint64_t branch;
         if (nextnode->increment_behaviors()) {
             /* Execute the same thread with a new behavior */
             tid = next->get_tid();
             node_stack->pop_restofstack(2);
+            branch = node_stack->hash_path(THREAD_ID_T_NONE);
         } else {
             ASSERT(prevnode);
             /* Make a different thread execute for next step */
@@ -130,7 +230,11 @@ Thread * ModelChecker::get_next_thread()
             if (diverge == earliest_diverge) {
                 earliest_diverge = prevnode->get_action();
             }
+            branch = node_stack->hash_path(tid);
         }
+        /* Leave branches claimed by other parallel workers to them */
+        if (!parallel_claim(branch))
+            unclaimed_execution = true;
         /* Start the round robin scheduler from this thread id */
         scheduler->set_scheduler_thread(tid);
         /* The correct sleep set is in the parent node. */
@@ -147,6 +251,31 @@ Thread * ModelChecker::get_next_thread()
     return get_thread(id_to_int(tid));
 }
 
+/**
+ * @brief Choose the next thread while replaying a branch handed over by
+ * another parallel worker
+ * @return The thread which the other worker ran at this step, or the thread
+ * choice which was handed over at the last step
+ */
+Thread * ModelChecker::get_replay_thread()
+{
+    const struct replay_prefix *prefix = node_stack->get_replay();
+    unsigned int step = node_stack->get_head_index() + 1;
+    ASSERT(step < prefix->num_steps);
+    thread_id_t tid = prefix->steps[step].tid;
+
+    if (step == prefix->num_steps - 1) {
+        /* Reached the branch: set up the sleep set as if we diverged here */
+        for (unsigned int i = 0; i < get_num_threads() && i < REPLAY_MAX_THREADS; i++)
+            if (prefix->sleep_set & ((uint64_t)1 << i))
+                scheduler->add_sleep(get_thread(int_to_id(i)));
+        scheduler->set_scheduler_thread(tid);
+        execute_sleep_set();
+        DEBUG("*** Reached handed-over branch ***\n");
+    }
+    return get_thread(tid);
+}
+
 /**
  * We need to know what the next actions of all threads in the sleep
  * set will be.  This method computes them and stores the actions at
@@ -236,16 +365,24 @@ void ModelChecker::record_stats()
          */
         //ASSERT(scheduler->all_threads_sleeping());
     }
+
+    parallel_publish_stats(&stats);
+}
+
+/** @brief Print a set of execution stats */
+void print_execution_stats(const struct execution_stats *stats)
+{
+    model_print("Number of complete, bug-free executions: %d\n", stats->num_complete);
+    model_print("Number of redundant executions: %d\n", stats->num_redundant);
+    model_print("Number of buggy executions: %d\n", stats->num_buggy_executions);
+    model_print("Number of infeasible executions: %d\n", stats->num_infeasible);
+    model_print("Total executions: %d\n", stats->num_total);
 }
 
 /** @brief Print execution stats */
 void ModelChecker::print_stats() const
 {
-    model_print("Number of complete, bug-free executions: %d\n", stats.num_complete);
-    model_print("Number of redundant executions: %d\n", stats.num_redundant);
-    model_print("Number of buggy executions: %d\n", stats.num_buggy_executions);
-    model_print("Number of infeasible executions: %d\n", stats.num_infeasible);
-    model_print("Total executions: %d\n", stats.num_total);
+    print_execution_stats(&stats);
     if (params.verbose)
         model_print("Total nodes created: %d\n", node_stack->get_total_nodes());
 }
@@ -291,8 +428,12 @@ void ModelChecker::print_execution(bool printbugs) const
 bool ModelChecker::next_execution()
 {
     DBG();
+    /* Unclaimed executions are reported by their claimer */
+    bool reported = !unclaimed_execution;
+    unclaimed_execution = false;
+
     /* Is this execution a feasible execution that's worth bug-checking? */
-    bool complete = execution->isfeasibleprefix() &&
+    bool complete = reported && execution->isfeasibleprefix() &&
         (execution->is_complete_execution() ||
          execution->have_bug_reports());
 
@@ -308,12 +449,15 @@ bool ModelChecker::next_execution()
          inspect_plugin->analyze(execution->get_action_trace());
     }
 
-    record_stats();
+    if (reported)
+        record_stats();
 
     /* Output */
-    if ( (complete && params.verbose) || params.verbose>1 || (complete && execution->have_bug_reports()))
+    if (reported && ((complete && params.verbose) || params.verbose>1 || (complete && execution->have_bug_reports()))) {
+        parallel_lock_output();
         print_execution(complete);
-    else
+        parallel_unlock_output();
+    } else
         clear_program_output();
 
     if (complete)
@@ -327,28 +471,75 @@ bool ModelChecker::next_execution()
     if (exit_flag)
         return false;
 
-    if ((diverge = execution->get_next_backtrack()) == NULL)
+    if (parallel_enabled())
+        share_work();
+
+    if ((diverge = execution->get_next_backtrack()) == NULL && !parallel_enabled())
         return false;
 
-    if (DBG_ENABLED()) {
+    if (DBG_ENABLED() && diverge) {
         model_print("Next execution will diverge at:\n");
         diverge->print();
     }
 
     execution_number++;
 
-    if (params.maxexecutions != 0 && stats.num_complete >= (int)params.maxexecutions)
+    int num_complete = parallel_enabled() ? parallel_num_complete() : stats.num_complete;
+    if (params.maxexecutions != 0 && num_complete >= (int)params.maxexecutions)
         return false;
 
+    /* Done with our own branches: help out another parallel worker */
+    if (diverge == NULL)
+        return steal_work();
+
     reset_to_initial_state();
     return true;
 }
 
+/** @brief Hand over unexplored branches to idle parallel workers, if any */
+void ModelChecker::share_work()
+{
+    struct replay_prefix *prefix;
+    while ((prefix = parallel_begin_share()) != NULL) {
+        bool found = node_stack->donate_branch(prefix);
+        parallel_end_share(found);
+        if (!found)
+            return;
+    }
+}
+
+/**
+ * @brief Wait for another parallel worker to hand over a branch, then set up
+ * the next execution to replay it
+ * @return True if there is a branch to explore; false if all workers ran out
+ * of branches
+ */
+bool ModelChecker::steal_work()
+{
+    if (!branch)
+        branch = (struct replay_prefix *)model_malloc(sizeof(*branch));
+    if (!parallel_steal_work(branch))
+        return false;
+
+    diverge = NULL;
+    earliest_diverge = NULL;
+    if (execution->get_curr_seq_num() != 0) {
+        reset_to_initial_state();
+        node_stack->full_reset();
+    }
+    node_stack->start_replay(branch);
+    return true;
+}
+
 /** @brief Run trace analyses on complete trace */
 void ModelChecker::run_trace_analyses() {
     IN_TRACE_ANALYSIS = true;
-    for (unsigned int i = 0; i < trace_analyses.size(); i++)
+    bool async = async_analysis_submit(&trace_analyses, execution->get_action_trace());
+    for (unsigned int i = 0; i < trace_analyses.size(); i++) {
+        if (async && trace_analyses[i]->canAnalyzeAsync())
+            continue;
         trace_analyses[i]->analyze(execution->get_action_trace());
+    }
     IN_TRACE_ANALYSIS = false;
 }
 
@@ -467,11 +658,17 @@ void ModelChecker::do_restart()
 /** @brief Run ModelChecker for the user program */
 void ModelChecker::run()
 {
-    bool has_next{false};
-    do {
-        thrd_t user_thread;
-        Thread *t = new Thread(execution->get_next_id(), &user_thread, &user_main_wrapper, NULL, NULL);
-        execution->add_thread(t);
+    /* Parallel workers but the first start out waiting for a branch */
+    bool has_next = parallel_worker_id() == 0 || steal_work();
+    /* Must outlive partial rollbacks, which keep the main Thread */
+    thrd_t user_thread;
+    while (has_next) {
+        Thread *t = NULL;
+        /* Otherwise, resume from a partial rollback */
+        if (execution->get_curr_seq_num() == 0) {
+            t = new Thread(execution->get_next_id(), &user_thread, &user_main_wrapper, NULL, NULL);
+            execution->add_thread(t);
+        }
 
         model_print("\n******* Execution %d ...\n", get_execution_number());
         do {
@@ -505,8 +702,10 @@ void ModelChecker::run()
             if (execution->has_asserted())
                 break;
 
-            if (!t)
+            if (!t) {
+                record_rollback_point();
                 t = get_next_thread();
+            }
             if (!t || t->is_model_thread())
                 break;
 
@@ -514,7 +713,7 @@ void ModelChecker::run()
             ModelAction *curr = t->get_pending();
             t->set_pending(NULL);
             t = execution->take_step(curr);
-        } while (!should_terminate_execution());
+        } while (!unclaimed_execution && !should_terminate_execution());
         model_print("******* Execution %d terminated, complete: %d\n", 
                     get_execution_number(), execution->is_complete_execution());
         //execution->print_summary();
@@ -529,14 +728,19 @@ void ModelChecker::run()
                 do_restart();
             }
         }
-    } while (has_next);
+    }
 
     execution->fixup_release_sequences();
+    parallel_retire();
 
-    model_print("\n******* Model-checking complete: *******\n");
-    print_stats();
+    /* The coordinator prints the merged stats of parallel workers */
+    if (!parallel_enabled()) {
+        model_print("\n******* Model-checking complete: *******\n");
+        print_stats();
+    }
 
     /* Have the trace analyses dump their output. */
+    async_analysis_drain(&trace_analyses);
     for (unsigned int i = 0; i < trace_analyses.size(); i++)
         trace_analyses[i]->finish();
 }
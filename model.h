@@ -10,6 +10,7 @@
 
 #include "mymemory.h"
 #include "hashtable.h"
+#include "chunklist.h"
 #include "config.h"
 #include "modeltypes.h"
 #include "stl-model.h"
@@ -27,8 +28,10 @@ class ClockVector;
 class TraceAnalysis;
 class ModelExecution;
 class ModelAction;
+struct rollback_point;
+struct replay_prefix;
 
-typedef SnapList<ModelAction *> action_list_t;
+typedef ChunkList<ModelAction *> action_list_t;
 
 /** @brief Model checker execution stats */
 struct execution_stats {
@@ -39,6 +42,8 @@ struct execution_stats {
     int num_redundant; /**< @brief Number of redundant, aborted executions */
 };
 
+void print_execution_stats(const struct execution_stats *stats);
+
 /** @brief The central structure for model-checking */
 class ModelChecker {
 public:
@@ -83,6 +88,9 @@ private:
     bool restart_flag;
     /** Flag indicates whether to exit the model checker. */
     bool exit_flag;
+    /** Flag indicates that the current execution diverged into a branch
+     *  claimed by another parallel worker; it is abandoned unreported. */
+    bool unclaimed_execution;
 
     /** The scheduler to use: tracks the running/ready Threads */
     Scheduler * const scheduler;
@@ -99,12 +107,23 @@ private:
     bool should_terminate_execution();
 
     Thread * get_next_thread();
+    Thread * get_replay_thread();
+    void share_work();
+    bool steal_work();
     void reset_to_initial_state();
+    void record_rollback_point();
 
 
     ModelAction *diverge;
     ModelAction *earliest_diverge;
 
+    /** @brief Mid-execution snapshots we may partially roll back to,
+     *  ordered by step */
+    ModelVector<struct rollback_point *> rollback_points;
+
+    /** @brief A branch handed over by another parallel worker */
+    struct replay_prefix *branch;
+
     ucontext_t system_context;
 
     ModelVector<TraceAnalysis *> trace_analyses;
@@ -10,6 +10,9 @@
 #include "modeltypes.h"
 #include "execution.h"
 #include "params.h"
+#include "parallel.h"
+
+SlabPool<model_malloc, model_free> Node::pool;
 
 /**
  * @brief Node constructor
@@ -751,10 +754,127 @@ bool Node::increment_behaviors()
     return false;
 }
 
+/** @brief Mix a value into a running hash */
+static inline uint64_t hash_combine(uint64_t hash, uint64_t val)
+{
+    return hash ^ (val + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+}
+
+/**
+ * @brief Hash the choices made at this Node in the current execution
+ *
+ * Together with the hashes of its ancestors, this identifies the path taken
+ * to (and through) this Node, independent of the process exploring it.
+ * @return A hash of the thread which ran this Node's action and of the
+ * behavior currently explored by that action
+ */
+uint64_t Node::hash_choices() const
+{
+    uint64_t hash = id_to_int(action->get_tid());
+    hash = hash_combine(hash, misc_index);
+    hash = hash_combine(hash, resolve_promise_idx);
+    hash = hash_combine(hash, read_from_status);
+    hash = hash_combine(hash, read_from_past_idx);
+    hash = hash_combine(hash, read_from_promise_idx);
+    hash = hash_combine(hash, relseq_break_index);
+    /*
+     * Workers discover future values in different orders, and with different
+     * expirations; hash the value, and which retry of that value this is
+     */
+    if (read_from_status == READ_FROM_FUTURE) {
+        const struct future_value *fv = &future_values[future_index];
+        unsigned int retry = 0;
+        for (int i = 0; i < future_index; i++)
+            if (future_values[i].value == fv->value && future_values[i].tid == fv->tid)
+                retry++;
+        hash = hash_combine(hash, fv->value);
+        hash = hash_combine(hash, retry);
+        hash = hash_combine(hash, id_to_int(fv->tid));
+    }
+    return hash;
+}
+
+/**
+ * @brief Record the choices made at this Node in the current execution
+ * @param step The record to fill in
+ */
+void Node::get_choices(struct replay_step *step) const
+{
+    step->tid = action->get_tid();
+    step->misc_index = misc_index;
+    step->resolve_promise_idx = resolve_promise_idx;
+    step->read_from_status = read_from_status;
+    step->read_from_past_idx = read_from_past_idx;
+    step->read_from_promise_idx = read_from_promise_idx;
+    step->relseq_break_index = relseq_break_index;
+    step->sleep_flag = action->get_sleep_flag();
+    step->sleep_set = 0;
+    step->explored = 0;
+    for (int i = 0; i < num_threads; i++) {
+        if (enabled_array && enabled_array[i] == THREAD_SLEEP_SET)
+            step->sleep_set |= (uint64_t)1 << i;
+        if (explored_children[i] || backtrack[i])
+            step->explored |= (uint64_t)1 << i;
+    }
+    if (read_from_status == READ_FROM_FUTURE)
+        step->future_value = future_values[future_index];
+}
+
+/**
+ * @brief Make this (new) Node repeat choices recorded by Node::get_choices()
+ *
+ * The earlier behaviors of the recorded Node are left unexplored; they
+ * belong to the worker which recorded it.
+ * @param step The recorded choices
+ */
+void Node::set_choices(const struct replay_step *step)
+{
+    misc_index = step->misc_index;
+    resolve_promise_idx = step->resolve_promise_idx;
+    read_from_status = step->read_from_status;
+    read_from_past_idx = step->read_from_past_idx;
+    read_from_promise_idx = step->read_from_promise_idx;
+    relseq_break_index = step->relseq_break_index;
+    /* May-read-from sets depend on it */
+    if (step->sleep_flag)
+        action->set_sleep_flag();
+    /* Leave the recording worker's thread choices to it */
+    for (int i = 0; i < num_threads; i++)
+        if (step->explored & ((uint64_t)1 << i))
+            explored_children[i] = true;
+    if (read_from_status == READ_FROM_FUTURE) {
+        future_values.push_back(step->future_value);
+        future_index = future_values.size() - 1;
+    }
+}
+
+/**
+ * @brief Mark the threads which slept when another worker explored this
+ * Node's current child
+ *
+ * A replayed prefix runs without sleep sets, but backtracking decisions must
+ * see the sleep sets of the worker which handed it over.
+ * @param sleep_set Bitmask of the sleeping threads
+ */
+void Node::restore_sleep_set(uint64_t sleep_set)
+{
+    for (int i = 0; i < num_threads; i++)
+        if ((sleep_set & ((uint64_t)1 << i)) && enabled_array[i] == THREAD_ENABLED)
+            enabled_array[i] = THREAD_SLEEP_SET;
+}
+
+/** @return True if a Thread is in this Node's backtrack set */
+bool Node::has_backtrack(thread_id_t tid) const
+{
+    int i = id_to_int(tid);
+    return i < (int)backtrack.size() && backtrack[i];
+}
+
 NodeStack::NodeStack() :
     node_list(),
     head_idx(-1),
-    total_nodes(0)
+    total_nodes(0),
+    replay(NULL)
 {
     total_nodes++;
 }
@@ -807,6 +927,8 @@ ModelAction * NodeStack::explore_action(ModelAction *act, enabled_type_t *is_ena
     Node *prevfairness = NULL;
     if (head) {
         head->explore_child(act, is_enabled);
+        if (replay && head_idx < (int)replay->num_steps - 2)
+            head->restore_sleep_set(replay->steps[head_idx].sleep_set);
         if (get_params()->fairwindow != 0 && head_idx > (int)get_params()->fairwindow)
             prevfairness = node_list[head_idx - get_params()->fairwindow];
     }
@@ -814,9 +936,18 @@ ModelAction * NodeStack::explore_action(ModelAction *act, enabled_type_t *is_ena
     int next_threads = execution->get_num_threads();
     if (act->get_type() == THREAD_CREATE)
         next_threads++;
-    node_list.push_back(new Node(get_params(), act, head, next_threads, prevfairness));
+    Node *node = new Node(get_params(), act, head, next_threads, prevfairness);
+    node_list.push_back(node);
     total_nodes++;
     head_idx++;
+
+    /* Recreate the Nodes of a handed-over branch, up to the branch itself */
+    if (replay) {
+        if (head_idx + 1 < (int)replay->num_steps)
+            node->set_choices(&replay->steps[head_idx]);
+        else
+            replay = NULL;
+    }
     return NULL;
 }
 
@@ -838,6 +969,86 @@ void NodeStack::pop_restofstack(int numAhead)
     node_list.back()->clear_backtracking();
 }
 
+/**
+ * @brief Hash the path through all Nodes of the stack
+ * @param next The thread chosen to run after the last Node, or
+ * THREAD_ID_T_NONE when the last Node's action explores a new behavior
+ * @return A hash identifying the branch of the backtracking tree about to be
+ * explored
+ */
+uint64_t NodeStack::hash_path(thread_id_t next) const
+{
+    uint64_t hash = node_list.size();
+    for (unsigned int i = 0; i < node_list.size(); i++)
+        hash = hash_combine(hash, node_list[i]->hash_choices());
+    return hash_combine(hash, id_to_int(next));
+}
+
+/**
+ * @brief Hand over an unexplored thread choice to another parallel worker
+ *
+ * Picks the shallowest backtracking point which no worker claimed yet and
+ * claims it on behalf of the receiving worker. Our own search later finds
+ * the branch claimed and skips it.
+ *
+ * @param prefix Filled in with the path to the branch
+ * @return True if a branch was found; false otherwise
+ */
+bool NodeStack::donate_branch(struct replay_prefix *prefix)
+{
+    unsigned int depth = node_list.size();
+    if (depth > PARALLEL_MAX_PREFIX - 1)
+        depth = PARALLEL_MAX_PREFIX - 1;
+
+    for (unsigned int i = 0; i < depth; i++) {
+        Node *node = node_list[i];
+        if (node->get_num_threads() > REPLAY_MAX_THREADS)
+            break;
+        for (int t = 0; t < node->get_num_threads(); t++) {
+            thread_id_t tid = int_to_id(t);
+            if (!node->has_backtrack(tid))
+                continue;
+
+            /* Same key as hash_path() after diverging here */
+            uint64_t hash = i + 1;
+            for (unsigned int j = 0; j <= i; j++)
+                hash = hash_combine(hash, node_list[j]->hash_choices());
+            if (!parallel_claim(hash_combine(hash, t)))
+                continue;
+
+            for (unsigned int j = 0; j <= i; j++)
+                node_list[j]->get_choices(&prefix->steps[j]);
+            /* Diverging resets the branching Node (see pop_restofstack()) */
+            prefix->steps[i].explored = 0;
+            prefix->steps[i + 1].tid = tid;
+            prefix->num_steps = i + 2;
+
+            /* The sleep set we would restore when diverging here */
+            prefix->sleep_set = prefix->steps[i].sleep_set;
+            if (i + 1 < node_list.size())
+                prefix->sleep_set |= (uint64_t)1 << id_to_int(node_list[i + 1]->get_action()->get_tid());
+            /* ...and the choices we explore here first (in thread order) */
+            for (int u = 0; u < t; u++)
+                if (node->has_backtrack(int_to_id(u)))
+                    prefix->sleep_set |= (uint64_t)1 << u;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Replay a branch handed over by another parallel worker
+ *
+ * Must be called on an empty stack, at the start of an execution.
+ * @param prefix The path to the branch; must outlive the replay
+ */
+void NodeStack::start_replay(const struct replay_prefix *prefix)
+{
+    ASSERT(node_list.empty());
+    replay = prefix;
+}
+
 /** Reset the node stack. */
 void NodeStack::full_reset() 
 {
@@ -869,7 +1080,13 @@ Node * NodeStack::get_next() const
     return node_list[it];
 }
 
-void NodeStack::reset_execution()
+/**
+ * @brief Rewind the replay iterator for a new execution
+ * @param num_explored The number of Nodes which are already explored in the
+ * (partially rolled back) execution; 0 to replay from the beginning
+ */
+void NodeStack::reset_execution(int num_explored)
 {
-    head_idx = -1;
+    head_idx = num_explored - 1;
+    replay = NULL;
 }
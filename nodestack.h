@@ -9,9 +9,11 @@
 #include <inttypes.h>
 
 #include "mymemory.h"
+#include "slabpool.h"
 #include "schedule.h"
 #include "promise.h"
 #include "stl-model.h"
+#include "config.h"
 
 class ModelAction;
 class Thread;
@@ -36,6 +38,50 @@ typedef enum {
     READ_FROM_NONE, /**< @brief A NULL state, which should not be reached */
 } read_from_type_t;
 
+/**
+ * @brief The thread and behavior chosen at a single Node
+ *
+ * Lets another parallel worker recreate the Node without exploring the
+ * behaviors which precede it.
+ */
+struct replay_step {
+    thread_id_t tid;
+    int misc_index;
+    int resolve_promise_idx;
+    read_from_type_t read_from_status;
+    unsigned int read_from_past_idx;
+    int read_from_promise_idx;
+    int relseq_break_index;
+    /** @brief Whether the Node's action was in the sleep set */
+    bool sleep_flag;
+    /** @brief Bitmask of the threads in the sleep set when the next step
+     *  was taken */
+    uint64_t sleep_set;
+    /** @brief Bitmask of the thread choices which the recording worker
+     *  explored or is about to explore */
+    uint64_t explored;
+    /** @brief The future value read; only valid for READ_FROM_FUTURE */
+    struct future_value future_value;
+};
+
+/**
+ * @brief An unexplored branch of the backtracking tree, handed over from one
+ * parallel worker to another
+ *
+ * The branch runs the thread of the last step (instead of the one the owner
+ * ran there) after replaying all of the preceding steps.
+ */
+struct replay_prefix {
+    unsigned int num_steps;
+    struct replay_step steps[PARALLEL_MAX_PREFIX];
+    /** @brief Bitmask of the threads in the sleep set when taking the last
+     *  step */
+    uint64_t sleep_set;
+};
+
+/** @brief Branches with more threads than this are not handed over */
+#define REPLAY_MAX_THREADS 64
+
 #define YIELD_E 1
 #define YIELD_D 2
 #define YIELD_S 4
@@ -121,11 +167,19 @@ public:
     bool relseq_break_empty() const;
 
     bool increment_behaviors();
+    uint64_t hash_choices() const;
+    void get_choices(struct replay_step *step) const;
+    void set_choices(const struct replay_step *step);
+    bool has_backtrack(thread_id_t tid) const;
+    void restore_sleep_set(uint64_t sleep_set);
 
     void print() const;
 
-    MEMALLOC
+    POOLALLOC(pool)
 private:
+    /** @brief Recycles the Nodes popped off the NodeStack */
+    static SlabPool<model_malloc, model_free> pool;
+
     void explore(thread_id_t tid);
     int get_yield_data(int tid1, int tid2) const;
     bool read_from_past_empty() const;
@@ -196,10 +250,15 @@ public:
     ModelAction * explore_action(ModelAction *act, enabled_type_t * is_enabled);
     Node * get_head() const;
     Node * get_next() const;
-    void reset_execution();
+    void reset_execution(int num_explored = 0);
     void pop_restofstack(int numAhead);
     void full_reset();
     int get_total_nodes() { return total_nodes; }
+    uint64_t hash_path(thread_id_t next) const;
+    bool donate_branch(struct replay_prefix *prefix);
+    void start_replay(const struct replay_prefix *prefix);
+    const struct replay_prefix * get_replay() const { return replay; }
+    int get_head_index() const { return head_idx; }
 
     void print() const;
 
@@ -221,6 +280,10 @@ private:
     int head_idx;
 
     int total_nodes;
+
+    /** @brief The branch handed over by another parallel worker which is
+     *  being replayed, or NULL */
+    const struct replay_prefix *replay;
 };
 
 #endif /* __NODESTACK_H__ */
@@ -0,0 +1,323 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "parallel.h"
+#include "common.h"
+#include "config.h"
+#include "model.h"
+#include "output.h"
+#include "nodestack.h"
+
+/** @brief What the coordinator and the other workers know of one worker */
+struct parallel_worker {
+    /** @brief Latest statistics published by the worker */
+    struct execution_stats stats;
+    /**
+     * @brief Whether the worker takes part in the search, i.e., does not
+     * count among the idle ones; protected by work_lock
+     */
+    bool busy;
+};
+
+/** @brief State shared by the coordinator and all of the workers */
+struct parallel_shared {
+    /** @brief Serializes execution reports of different workers */
+    pthread_mutex_t output_lock;
+    /** @brief Open-addressed set of claimed branch keys (0 = empty) */
+    uint64_t claims[PARALLEL_CLAIM_TABLE_SIZE];
+    /** @brief Protects the fields below */
+    pthread_mutex_t work_lock;
+    /** @brief Signalled when work is queued or the last worker runs out */
+    pthread_cond_t work_cond;
+    /** @brief Number of workers waiting for (or done with) work */
+    unsigned int num_idle;
+    /** @brief Ring buffer of branches handed over to idle workers */
+    struct replay_prefix work[PARALLEL_WORK_QUEUE_SIZE];
+    unsigned int work_head;
+    unsigned int work_count;
+    struct parallel_worker workers[];
+};
+
+static struct parallel_shared *shared = NULL;
+static unsigned int num_jobs = 1;
+static unsigned int worker_id = 0;
+
+static void * shared_mmap(size_t size)
+{
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    return mem;
+}
+
+/**
+ * @brief Lock a mutex of the shared state, even if its owner died
+ *
+ * The mutexes are robust: a worker which crashes while holding one leaves it
+ * to the next process locking it, rather than locked forever.
+ */
+static void lock_shared(pthread_mutex_t *lock)
+{
+    if (pthread_mutex_lock(lock) == EOWNERDEAD)
+        pthread_mutex_consistent(lock);
+}
+
+/** @brief Wait on the work condition, with work_lock held as by lock_shared() */
+static void wait_shared()
+{
+    if (pthread_cond_wait(&shared->work_cond, &shared->work_lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&shared->work_lock);
+}
+
+/** @brief Count this worker among the idle ones, with work_lock held */
+static void become_idle(unsigned int id)
+{
+    shared->workers[id].busy = false;
+    shared->num_idle++;
+    pthread_cond_broadcast(&shared->work_cond);
+}
+
+/**
+ * @brief Wait for all workers to finish, then print the merged statistics
+ *
+ * Runs in the coordinator; does not return.
+ * @param pids The process IDs of the workers, by worker index
+ */
+static void coordinate(const pid_t *pids)
+{
+    int status = EXIT_SUCCESS;
+    for (unsigned int i = 0; i < num_jobs; i++) {
+        int wstatus;
+        pid_t pid = wait(&wstatus);
+        if (pid < 0) {
+            perror("wait");
+            exit(EXIT_FAILURE);
+        }
+        if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+            model_print("A model-checking worker failed\n");
+            status = EXIT_FAILURE;
+            /* Don't leave the others waiting for its branches */
+            lock_shared(&shared->work_lock);
+            for (unsigned int id = 0; id < num_jobs; id++)
+                if (pids[id] == pid && shared->workers[id].busy)
+                    become_idle(id);
+            pthread_mutex_unlock(&shared->work_lock);
+        }
+    }
+
+    struct execution_stats total;
+    memset(&total, 0, sizeof(total));
+    for (unsigned int i = 0; i < num_jobs; i++) {
+        const struct execution_stats *stats = &shared->workers[i].stats;
+        total.num_total += stats->num_total;
+        total.num_infeasible += stats->num_infeasible;
+        total.num_buggy_executions += stats->num_buggy_executions;
+        total.num_complete += stats->num_complete;
+        total.num_redundant += stats->num_redundant;
+    }
+
+    model_print("\n******* Model-checking complete (%u jobs): *******\n", num_jobs);
+    print_execution_stats(&total);
+    exit(status);
+}
+
+/**
+ * @brief Fork the model-checking workers
+ *
+ * Returns in each worker; the calling process becomes the coordinator and
+ * exits once all workers are done. Does nothing for a single job.
+ *
+ * @param jobs The number of workers
+ */
+void parallel_init(unsigned int jobs)
+{
+    if (jobs <= 1)
+        return;
+
+    num_jobs = jobs;
+    shared = (struct parallel_shared *)shared_mmap(sizeof(*shared) + jobs * sizeof(struct parallel_worker));
+    for (unsigned int i = 0; i < jobs; i++)
+        shared->workers[i].busy = true;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&shared->output_lock, &attr);
+    pthread_mutex_init(&shared->work_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&shared->work_cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    /* Don't duplicate buffered output in every worker */
+    fflush(stdout);
+    clear_program_output();
+
+    pid_t *pids = (pid_t *)model_calloc(jobs, sizeof(pid_t));
+    for (unsigned int i = 0; i < jobs; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            perror("fork");
+            exit(EXIT_FAILURE);
+        } else if (pids[i] == 0) {
+            worker_id = i;
+            reopen_program_output();
+            return;
+        }
+    }
+    coordinate(pids);
+}
+
+/** @return True if this process is one of several model-checking workers */
+bool parallel_enabled()
+{
+    return shared != NULL;
+}
+
+/** @return The index of this worker; 0 when not running in parallel */
+unsigned int parallel_worker_id()
+{
+    return worker_id;
+}
+
+/**
+ * @brief Claim a branch of the backtracking tree for this worker
+ * @param key A hash identifying the branch (see NodeStack::hash_path())
+ * @return True if this worker should explore the branch; false if another
+ * worker already claimed it
+ */
+bool parallel_claim(uint64_t key)
+{
+    if (!shared)
+        return true;
+    if (key == 0)
+        key = 1;
+
+    for (unsigned int probe = 0; probe < PARALLEL_CLAIM_TABLE_SIZE; probe++) {
+        uint64_t *slot = &shared->claims[(key + probe) % PARALLEL_CLAIM_TABLE_SIZE];
+        uint64_t expected = 0;
+        if (__atomic_compare_exchange_n(slot, &expected, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return true;
+        if (expected == key)
+            return false;
+    }
+    /* Table full: exploring a branch twice is better than missing it */
+    return true;
+}
+
+/** @brief Make this worker's statistics visible to the others */
+void parallel_publish_stats(const struct execution_stats *stats)
+{
+    if (shared)
+        shared->workers[worker_id].stats = *stats;
+}
+
+/**
+ * @return The number of complete, bug-free executions reported by all
+ * workers so far
+ */
+int parallel_num_complete()
+{
+    if (!shared)
+        return 0;
+    int num = 0;
+    for (unsigned int i = 0; i < num_jobs; i++)
+        num += shared->workers[i].stats.num_complete;
+    return num;
+}
+
+/** @brief Start printing a report which must not interleave with others */
+void parallel_lock_output()
+{
+    if (shared)
+        lock_shared(&shared->output_lock);
+}
+
+/** @brief Done printing a report started by parallel_lock_output() */
+void parallel_unlock_output()
+{
+    if (shared)
+        pthread_mutex_unlock(&shared->output_lock);
+}
+
+/**
+ * @brief Start handing over a branch to an idle worker
+ * @return The queue slot to record the branch in, or NULL if no worker waits
+ * for a branch that was not handed over yet. Unless NULL, the queue stays
+ * locked until parallel_end_share().
+ */
+struct replay_prefix * parallel_begin_share()
+{
+    if (!shared || __atomic_load_n(&shared->num_idle, __ATOMIC_RELAXED) == 0)
+        return NULL;
+
+    lock_shared(&shared->work_lock);
+    if (shared->num_idle <= shared->work_count || shared->work_count == PARALLEL_WORK_QUEUE_SIZE) {
+        pthread_mutex_unlock(&shared->work_lock);
+        return NULL;
+    }
+    return &shared->work[(shared->work_head + shared->work_count) % PARALLEL_WORK_QUEUE_SIZE];
+}
+
+/**
+ * @brief Done handing over a branch started by parallel_begin_share()
+ * @param filled True if a branch was recorded in the queue slot
+ */
+void parallel_end_share(bool filled)
+{
+    if (filled) {
+        shared->work_count++;
+        pthread_cond_signal(&shared->work_cond);
+    }
+    pthread_mutex_unlock(&shared->work_lock);
+}
+
+/**
+ * @brief Wait until another worker hands over a branch
+ * @param prefix Filled in with the branch
+ * @return True if a branch was handed over; false once all workers are idle,
+ * i.e., the whole backtracking tree is explored
+ */
+bool parallel_steal_work(struct replay_prefix *prefix)
+{
+    lock_shared(&shared->work_lock);
+    if (shared->workers[worker_id].busy)
+        become_idle(worker_id);
+    while (shared->work_count == 0 && shared->num_idle < num_jobs)
+        wait_shared();
+
+    bool stolen = shared->work_count != 0;
+    if (stolen) {
+        *prefix = shared->work[shared->work_head];
+        shared->work_head = (shared->work_head + 1) % PARALLEL_WORK_QUEUE_SIZE;
+        shared->work_count--;
+        shared->num_idle--;
+        shared->workers[worker_id].busy = true;
+    }
+    pthread_mutex_unlock(&shared->work_lock);
+    return stolen;
+}
+
+/** @brief Stop taking part in the search, without waiting for other workers */
+void parallel_retire()
+{
+    if (!shared)
+        return;
+    lock_shared(&shared->work_lock);
+    if (shared->workers[worker_id].busy)
+        become_idle(worker_id);
+    pthread_mutex_unlock(&shared->work_lock);
+}
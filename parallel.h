@@ -0,0 +1,38 @@
+/** @file parallel.h
+ *  @brief Parallel model checking with forked worker processes.
+ *
+ *  The first worker starts exploring the backtracking tree from its root;
+ *  the others start out idle. A busy worker hands over its shallowest
+ *  unexplored thread choices to idle workers as replay prefixes (the choices
+ *  made at every Node on the path to the branch), and an idle worker replays
+ *  such a prefix before exploring the subtree below it.
+ *
+ *  Each branch (a divergence from a previously explored path) is claimed by
+ *  exactly one worker through a table shared by all workers. A worker that
+ *  loses a claim abandons that branch right after diverging. The search ends
+ *  once all workers are idle, and the coordinator (the original process)
+ *  merges the workers' statistics.
+ */
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <stdint.h>
+
+struct execution_stats;
+struct replay_prefix;
+
+void parallel_init(unsigned int jobs);
+bool parallel_enabled();
+unsigned int parallel_worker_id();
+bool parallel_claim(uint64_t key);
+void parallel_publish_stats(const struct execution_stats *stats);
+int parallel_num_complete();
+void parallel_lock_output();
+void parallel_unlock_output();
+struct replay_prefix * parallel_begin_share();
+void parallel_end_share(bool filled);
+bool parallel_steal_work(struct replay_prefix *prefix);
+void parallel_retire();
+
+#endif /* __PARALLEL_H__ */
@@ -25,6 +25,35 @@ struct model_params {
      *  value */
     unsigned int expireslop;
 
+    /** @brief Number of steps between mid-execution snapshots used for
+     *  partial rollback (0 = always replay from the initial state) */
+    unsigned int snapshotinterval;
+
+    /** @brief Number of backing pages initially reserved for snapshots (the
+     *  backing store grows beyond this as needed) */
+    unsigned int backingpages;
+
+    /** @brief Number of snapshot records initially reserved (grows as
+     *  needed) */
+    unsigned int numsnapshots;
+
+    /** @brief Maximum number of memory regions to snapshot */
+    unsigned int snapshotregions;
+
+    /** @brief Size, in pages, of each of the snapshotting heaps (the user
+     *  program's and the model checker's) */
+    unsigned int heappages;
+
+    /** @brief Number of worker processes exploring executions in parallel */
+    unsigned int jobs;
+
+    /** @brief Maximum number of processes running trace analyses alongside
+     *  the exploration (0 = run them in line) */
+    unsigned int analysisjobs;
+
+    /** @brief Record the callstack of each action, for bug reports */
+    bool callstacks;
+
     /** @brief Verbosity (0 = quiet; 1 = noisy; 2 = noisier) */
     int verbose;
 
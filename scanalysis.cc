@@ -15,6 +15,8 @@ SCAnalysis::SCAnalysis() :
     badrfset(),
     lastwrmap(),
     threadlists(1),
+    numbuilt(0),
+    firstbuilt(NULL),
     execution(NULL),
     fastVersion(true),
     allowNonSC(false),
@@ -24,8 +26,10 @@ SCAnalysis::SCAnalysis() :
     time(false),
     stats((struct sc_statistics *)model_calloc(1, sizeof(struct sc_statistics)))
 {
-    updateSet = new const_actions_t;
+    updateSet = new SnapList<const ModelAction *>;
     updateSetSize = 0;
+    trailmark = -1;
+    memset(&prefixstats, 0, sizeof(prefixstats));
 }
 
 SCAnalysis::~SCAnalysis() {
@@ -68,6 +72,56 @@ void SCAnalysis::finish() {
     model_print("Maximum length of write lists: %llu\n", stats->writeListsMaxLength);
 }
 
+bool SCAnalysis::canRollBackPartially() {
+    return true;
+}
+
+bool SCAnalysis::canAnalyzeAsync() {
+    return true;
+}
+
+void SCAnalysis::clearResults() {
+    memset(stats, 0, sizeof(*stats));
+}
+
+size_t SCAnalysis::saveResults(void *buf, size_t size) {
+    ASSERT(size >= sizeof(*stats));
+    memcpy(buf, stats, sizeof(*stats));
+    return sizeof(*stats);
+}
+
+void SCAnalysis::mergeResults(const void *buf, size_t size) {
+    struct sc_statistics s;
+    ASSERT(size == sizeof(s));
+    memcpy(&s, buf, sizeof(s));
+    add_stats(&s);
+}
+
+/** @brief Add statistics gathered elsewhere to ours */
+void SCAnalysis::add_stats(const struct sc_statistics *other) {
+    const struct sc_statistics &s = *other;
+    stats->elapsedtime += s.elapsedtime;
+    stats->sccount += s.sccount;
+    stats->nonsccount += s.nonsccount;
+    stats->actions += s.actions;
+    stats->buildVectorTime += s.buildVectorTime;
+    stats->computeCVTime += s.computeCVTime;
+    stats->computeCVOtherTime += s.computeCVOtherTime;
+    stats->passChangeTime += s.passChangeTime;
+    stats->processReadTime += s.processReadTime;
+    stats->reads += s.reads;
+    stats->writes += s.writes;
+    stats->processedReads += s.processedReads;
+    stats->writeListsLength += s.writeListsLength;
+    if (s.writeListsMaxLength > stats->writeListsMaxLength)
+        stats->writeListsMaxLength = s.writeListsMaxLength;
+    if (s.writeListMaxSearchTime > stats->writeListMaxSearchTime)
+        stats->writeListMaxSearchTime = s.writeListMaxSearchTime;
+    stats->processedWrites += s.processedWrites;
+    stats->pushCount += s.pushCount;
+    stats->mergeCount += s.mergeCount;
+}
+
 bool SCAnalysis::option(char * opt) {
     if (strcmp(opt, "verbose")==0) {
         print_always=true;
@@ -121,11 +175,33 @@ void SCAnalysis::print_list(action_list_t *list) {
     model_print("---------------------------------------------------------------------\n");
 }
 
+/**
+ * Builds the vectors, nodes and write lists of the actions so far, which the
+ * snapshot keeps for every execution resuming from it. Only the actions behind
+ * the snapshot are left for analyze() to build.
+ */
+void SCAnalysis::analyzePrefix(action_list_t *actions) {
+    /* Counted by analyze(), once for each execution sharing the prefix */
+    struct sc_statistics *execstats = stats;
+    stats = &prefixstats;
+    fastVersion = true;
+    buildVectorsFast(actions);
+    stats = execstats;
+}
+
 void SCAnalysis::analyze(action_list_t *actions) {
     struct timeval start;
     struct timeval finish;
     if (time)
         gettimeofday(&start, NULL);
+    if (numbuilt > 0 && actions->front() != firstbuilt) {
+        /* Uninitialized-value actions were added in front of the prefix */
+        reset(actions);
+        nodeMap.reset();
+        writeMap.reset();
+        memset(&prefixstats, 0, sizeof(prefixstats));
+    }
+    add_stats(&prefixstats);
     /* Run as the fast version at first */
     fastVersion = true;
     action_list_t *list = generateSC(actions);
@@ -194,6 +270,7 @@ bool SCAnalysis::merge(ClockVector *cv, const ModelAction *act, const ModelActio
         //refuse to introduce cycles into clock vectors
         return false;
     }
+    saveCV(cv, act);
     if (fastVersion) {
         status = cv->merge(cv2);
         return status;
@@ -326,6 +403,101 @@ ModelAction * SCAnalysis::pruneArray(ModelAction **array,int count) {
     return nonconflict;
 }
 
+/**
+ * @brief Save a ClockVector to the trail before changing it, unless it was
+ * saved since the latest choice point already
+ * @param cv The ClockVector about to change
+ * @param act The action of the ClockVector
+ */
+void SCAnalysis::saveCV(ClockVector *cv, const ModelAction *act) {
+    if (trailmark < 0)
+        return;
+    unsigned int pos = trailpos.get(cv);
+    if (pos > (unsigned int)trailmark && pos <= trail.size() && trail[pos - 1].cv == cv)
+        return;
+    struct cv_undo undo = { cv, new ClockVector(NULL, act) };
+    undo.saved->assign(cv);
+    trail.push_back(undo);
+    trailpos.put(cv, trail.size());
+}
+
+/** @brief Restore the ClockVectors saved to the trail since a mark */
+void SCAnalysis::undoCVs(unsigned int mark) {
+    while (trail.size() > mark) {
+        struct cv_undo &undo = trail.back();
+        undo.cv->assign(undo.saved);
+        delete undo.saved;
+        trail.pop_back();
+    }
+}
+
+/**
+ * @brief Record a choice point of generateSC(), where the first candidate is
+ * tried now
+ * @param choices The choice points so far
+ * @param array The candidates
+ * @param numActions The number of candidates
+ * @param sclist The SC order so far
+ */
+void SCAnalysis::pushChoice(ModelVector<struct sc_choice> *choices, ModelAction **array, int numActions, action_list_t *sclist) {
+    struct sc_choice choice;
+    choice.actions = (ModelAction **)model_malloc(numActions * sizeof(ModelAction *));
+    memcpy(choice.actions, array, numActions * sizeof(ModelAction *));
+    choice.numactions = numActions;
+    choice.next = 1;
+    choice.sclength = sclist->size();
+    choice.trailmark = trail.size();
+    choice.updateSetSize = updateSetSize;
+    choice.cyclic = cyclic;
+    choice.allowNonSC = allowNonSC;
+    choices->push_back(choice);
+    trailmark = choice.trailmark;
+}
+
+/**
+ * @brief Undo the SC order back to the latest choice point with candidates
+ * left to try, instead of starting over
+ * @param choices The choice points so far
+ * @param act The action whose constraints turned out cyclic
+ * @param sclist The SC order so far
+ * @return The next candidate of the choice point, or NULL if there is none
+ * left, i.e., if the trace is not SC
+ */
+ModelAction * SCAnalysis::backtrack(ModelVector<struct sc_choice> *choices, ModelAction *act, action_list_t *sclist) {
+    while (!choices->empty() && choices->back().next == choices->back().numactions) {
+        model_free(choices->back().actions);
+        choices->pop_back();
+    }
+    if (choices->empty())
+        return NULL;
+
+    struct sc_choice *choice = &choices->back();
+    undoCVs(choice->trailmark);
+    trailmark = choice->trailmark;
+    /* Put the actions back into their threads, latest first */
+    threadlists[id_to_int(act->get_tid())].push_front(act);
+    while (sclist->size() > choice->sclength) {
+        ModelAction *last = sclist->back();
+        sclist->pop_back();
+        threadlists[id_to_int(last->get_tid())].push_front(last);
+    }
+    while (updateSetSize > choice->updateSetSize) {
+        updateSet->pop_back();
+        updateSetSize--;
+    }
+    cyclic = choice->cyclic;
+    allowNonSC = choice->allowNonSC;
+    return choice->actions[choice->next++];
+}
+
+/**
+ * @brief Order the actions of a trace in an SC order consistent with its
+ * constraints
+ *
+ * Searches depth first: where several actions may come next, tries each in
+ * turn, backtracking through the trail of changed ClockVectors once the
+ * constraints of a choice turn out cyclic.
+ */
 action_list_t * SCAnalysis::generateSC(action_list_t *list) {
     struct timeval start;
     struct timeval finish;
@@ -349,28 +521,19 @@ action_list_t * SCAnalysis::generateSC(action_list_t *list) {
 
     action_list_t *sclist = new action_list_t();
     ModelAction **array = (ModelAction **)model_calloc(1, (maxthreads + 1) * sizeof(ModelAction *));
-    int * choices = (int *) model_calloc(1, sizeof(int)*numactions);
-    int endchoice = 0;
-    int currchoice = 0;
-    int lastchoice = -1;
+    ModelVector<struct sc_choice> choices;
+    ModelAction *next = NULL;
     while (true) {
-        int numActions = getNextActions(array);
-        if (numActions == 0)
-            break;
-        ModelAction * act=pruneArray(array, numActions);
+        ModelAction *act = next;
+        next = NULL;
         if (act == NULL) {
-            if (currchoice < endchoice) {
-                act = array[choices[currchoice]];
-                //check whether there is still another option
-                if ((choices[currchoice]+1)<numActions)
-                    lastchoice=currchoice;
-                currchoice++;
-            } else {
+            int numActions = getNextActions(array);
+            if (numActions == 0)
+                break;
+            act = pruneArray(array, numActions);
+            if (act == NULL) {
+                pushChoice(&choices, array, numActions, sclist);
                 act = array[0];
-                choices[currchoice]=0;
-                if (numActions>1)
-                    lastchoice=currchoice;
-                currchoice++;
             }
         }
         thread_id_t tid = act->get_tid();
@@ -384,30 +547,42 @@ action_list_t * SCAnalysis::generateSC(action_list_t *list) {
             if (!prevc && cyclic) {
                 model_print("ROLLBACK in SC\n");
                 //check whether we have another choice
-                if (lastchoice != -1) {
-                    //have to reset everything
-                    choices[lastchoice]++;
-                    endchoice=lastchoice+1;
-                    currchoice=0;
-                    lastchoice=-1;
-                    reset(list);
-                    buildVectors(list);
-                    computeCV(list);
-                    sclist->clear();
+                next = backtrack(&choices, act, sclist);
+                if (next != NULL)
                     continue;
-                } else { // We found that it is non-SC
-                    fastVersion = false;
-                    return sclist;
-                }
+                // We found that it is non-SC
+                fastVersion = false;
+                break;
             }
         }
         //add action to end
         sclist->push_back(act);
     }
+
+    /* Keep the changes of the choices made */
+    for (unsigned int i = 0; i < choices.size(); i++)
+        model_free(choices[i].actions);
+    for (unsigned int i = 0; i < trail.size(); i++)
+        delete trail[i].saved;
+    if (!trail.empty()) {
+        trail.clear();
+        trailpos.reset();
+    }
+    trailmark = -1;
     model_free(array);
     return sclist;
 }
 
+/**
+ * @brief Start loading the ClockVector entry of the action a few actions
+ * ahead in the list, while the current one is looked up
+ */
+void SCAnalysis::prefetchCV(action_list_t *list, action_list_t::iterator it) {
+    unsigned int pos = it.get_pos() + HASHTABLE_PREFETCH_DISTANCE;
+    if (pos < list->end().get_pos())
+        cvmap.prefetch(list->at_pos(pos));
+}
+
 int SCAnalysis::buildVectors(action_list_t *list) {
     if (fastVersion)
         return buildVectorsFast(list);
@@ -429,11 +604,19 @@ void SCAnalysis::popUpdateSet() {
     updateSetSize--;
 }
 
+/**
+ * @brief Build the vectors, nodes and write lists of the actions not built
+ * yet, i.e., behind the prefix built before the last reset() or snapshot
+ * @return The number of actions in the list
+ */
 int SCAnalysis::buildVectorsFast(action_list_t *list) {
-    maxthreads = 0;
-    int numactions = 0;
-    for (action_list_t::iterator it = list->begin(); it != list->end(); it++) {
+    if (numbuilt == 0) {
+        maxthreads = 0;
+        firstbuilt = list->empty() ? NULL : list->front();
+    }
+    for (action_list_t::iterator it(list, list->begin().get_pos() + numbuilt); it != list->end(); it++) {
         ModelAction *act = *it;
+        prefetchCV(list, it);
 
         ClockVector *cv = cvmap.get(act);
         if (cv == NULL) {
@@ -441,7 +624,7 @@ int SCAnalysis::buildVectorsFast(action_list_t *list) {
             cvmap.put(act, cv);
         }
 
-        numactions++;
+        numbuilt++;
         int threadid = id_to_int(act->get_tid());
         if (threadid > maxthreads) {
             threadlists.resize(threadid + 1);
@@ -454,7 +637,7 @@ int SCAnalysis::buildVectorsFast(action_list_t *list) {
             writeLists = new SnapVector<SnapVector<ModelAction*>*>;
             writeMap.put(loc, writeLists);
         }
-        if (std::cmp_less(writeLists->size(), threadid)) {  // writeLists->size() <= threadid)
+        if (std::cmp_less_equal(writeLists->size(), threadid)) {
             writeLists->resize(threadid + 1);
         }
         SnapVector<ModelAction*> *writeList = (*writeLists)[threadid];
@@ -474,7 +657,7 @@ int SCAnalysis::buildVectorsFast(action_list_t *list) {
             //act->print();
         }
 
-        ModelAction *lastAct = threadlists[threadid].back();
+        ModelAction *lastAct = threadlists[threadid].empty() ? NULL : threadlists[threadid].back();
         /* Add the sb edge */
         if (lastAct != NULL) {
             action_node *lastNode = nodeMap.get(lastAct);
@@ -535,7 +718,7 @@ int SCAnalysis::buildVectorsFast(action_list_t *list) {
         }
         threadlists[threadid].push_back(act);
     }
-    return numactions;
+    return numbuilt;
 }
 
 int SCAnalysis::buildVectorsSlow(action_list_t *list) {
@@ -543,6 +726,7 @@ int SCAnalysis::buildVectorsSlow(action_list_t *list) {
     int numactions = 0;
     for (action_list_t::iterator it = list->begin(); it != list->end(); it++) {
         ModelAction *act = *it;
+        prefetchCV(list, it);
 
         ClockVector *cv = cvmap.get(act);
         if (cv == NULL) {
@@ -568,10 +752,13 @@ void SCAnalysis::reset(action_list_t *list) {
     }
     for (action_list_t::iterator it = list->begin(); it != list->end(); it++) {
         ModelAction *act = *it;
+        prefetchCV(list, it);
         delete cvmap.get(act);
         cvmap.put(act, NULL);
     }
     updateSet->clear();
+    updateSetSize = 0;
+    numbuilt = 0;
 
     cyclic=false;   
 }
@@ -69,21 +69,49 @@ typedef struct action_node {
     SNAPSHOTALLOC
 } action_node;
 
+/** @brief A ClockVector as it was before a choice of generateSC() */
+struct cv_undo {
+    ClockVector *cv;
+    ClockVector *saved;
+};
+
+/** @brief A point where generateSC() picked one of several candidates for the
+ *  next action in the SC order, and the state to try the others from */
+struct sc_choice {
+    ModelAction **actions;
+    int numactions;
+    /** The candidate to try next */
+    int next;
+    unsigned int sclength;
+    unsigned int trailmark;
+    unsigned int updateSetSize;
+    bool cyclic;
+    bool allowNonSC;
+};
+
 class SCAnalysis : public TraceAnalysis {
  public:
     SCAnalysis();
     ~SCAnalysis();
     virtual void setExecution(ModelExecution * execution);
     virtual void analyze(action_list_t *);
+    virtual void analyzePrefix(action_list_t *);
+    virtual bool canRollBackPartially();
     virtual const char * name();
     virtual bool option(char *);
     virtual void finish();
+    virtual bool canAnalyzeAsync();
+    virtual void clearResults();
+    virtual size_t saveResults(void *buf, size_t size);
+    virtual void mergeResults(const void *buf, size_t size);
 
 
     SNAPSHOTALLOC
  private:
     void update_stats();
+    void add_stats(const struct sc_statistics *other);
     void print_list(action_list_t *list);
+    void prefetchCV(action_list_t *list, action_list_t::iterator it);
     int buildVectors(action_list_t *);
     int buildVectorsSlow(action_list_t *);
     int buildVectorsFast(action_list_t *);
@@ -99,6 +127,10 @@ class SCAnalysis : public TraceAnalysis {
     void check_rf(action_list_t *list);
     void reset(action_list_t *list);
     ModelAction* pruneArray(ModelAction**, int);
+    void pushChoice(ModelVector<struct sc_choice> *choices, ModelAction **array, int numActions, action_list_t *sclist);
+    ModelAction * backtrack(ModelVector<struct sc_choice> *choices, ModelAction *act, action_list_t *sclist);
+    void saveCV(ClockVector *cv, const ModelAction *act);
+    void undoCVs(unsigned int mark);
     
     /** Extract the set of reads to the list */
     void getWriteActions(const_actions_t *list);
@@ -119,6 +151,12 @@ class SCAnalysis : public TraceAnalysis {
     HashTable<const ModelAction *, const ModelAction *, uintptr_t, 4 > badrfset;
     HashTable<void *, const ModelAction *, uintptr_t, 4 > lastwrmap;
     SnapVector<action_list_t> threadlists;
+    /** The number of actions (from the start of the trace) that
+     *  buildVectorsFast() has built since the last reset() */
+    unsigned int numbuilt;
+    /** The first of these actions; the execution adds uninitialized-value
+     *  actions in front of the trace */
+    const ModelAction *firstbuilt;
     ModelExecution *execution;
     /** fastVersion -> at first, we don't care whether we prioritize the SC or hb
      *  edges and just randomly add any edges that we can.
@@ -141,13 +179,25 @@ class SCAnalysis : public TraceAnalysis {
     HashTable<const ModelAction *, action_node*, uintptr_t, 4 > nodeMap;
     /** The list of write operations per location/thread */
     HashTable<void *, SnapVector<SnapVector<ModelAction*>*>*, uintptr_t, 4 > writeMap;
-    const_actions_t *updateSet;
+    /** Snapshotting, as analyzePrefix() leaves changes to propagate */
+    SnapList<const ModelAction *> *updateSet;
     unsigned int updateSetSize;
+    /** The ClockVectors changed since the first choice point of generateSC(),
+     *  to backtrack without starting over */
+    SnapVector<struct cv_undo> trail;
+    /** Where each ClockVector was last saved to the trail, plus one */
+    HashTable<const ClockVector *, unsigned int, uintptr_t, 4 > trailpos;
+    /** Where the latest choice point starts in the trail; -1 outside of
+     *  choice points */
+    int trailmark;
 
     bool print_always;
     bool print_buggy;
     bool print_nonsc;
     bool time;
     struct sc_statistics *stats;
+    /** Statistics of building the trace prefix in analyzePrefix(); rolled
+     *  back with the prefix */
+    struct sc_statistics prefixstats;
 };
 #endif
@@ -0,0 +1,129 @@
+/** @file slabpool.h
+ *  @brief Pools for the model-checker's most frequently allocated objects.
+ */
+
+#ifndef __SLABPOOL_H__
+#define __SLABPOOL_H__
+
+#include <stddef.h>
+#include <stdlib.h>
+#include "mymemory.h"
+#include "common.h"
+
+/** @brief Size of the slabs from which a SlabPool carves its objects */
+#define SLABPOOL_SLAB_SIZE 16384
+
+/** POOLALLOC declares the allocators for a class to recycle its objects
+ *  through a SlabPool. Arrays bypass the pool. */
+#define POOLALLOC(pool) \
+    void * operator new(size_t size) { \
+        return (pool).allocate(size); \
+    } \
+    void operator delete(void *p, size_t size) { \
+        (pool).deallocate(p); \
+    } \
+    void * operator new[](size_t size) { \
+        return (pool).allocate_array(size); \
+    } \
+    void operator delete[](void *p, size_t size) { \
+        (pool).deallocate_array(p); \
+    } \
+    void * operator new(size_t size, void *p) { /* placement new */ \
+        return p; \
+    }
+
+/**
+ * @brief A pool of equally-sized objects
+ *
+ * Carves objects from slabs, one after the other, and keeps the freed ones on
+ * a free list for reuse. Slabs are never returned to the heap, so allocating
+ * and freeing objects costs a few instructions instead of a malloc()/free()
+ * each.
+ *
+ * A pool allocating from the snapshotting heap must itself live in the
+ * snapshotting heap, so that rolling back a snapshot rolls back the pool with
+ * the objects it handed out.
+ *
+ * @tparam _malloc Provide your own 'malloc' for the pool, or default to
+ *                 snapshotting.
+ * @tparam _free   Provide your own 'free' for the pool, or default to
+ *                 snapshotting.
+ */
+template<void * (* _malloc)(size_t) = snapshot_malloc, void (*_free)(void *) = snapshot_free>
+class SlabPool {
+ public:
+    constexpr SlabPool() :
+        freelist(NULL),
+        next(NULL),
+        end(NULL),
+        objsize(0)
+    { }
+
+    /**
+     * @brief Allocate an object
+     * @param size The object size; the same for all objects of the pool
+     * @return The object's memory
+     */
+    void * allocate(size_t size) {
+        if (!objsize) {
+            /* Keep every object suitably aligned */
+            objsize = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+            ASSERT(objsize <= SLABPOOL_SLAB_SIZE);
+        }
+        ASSERT(size <= objsize);
+
+        if (freelist) {
+            struct free_object *obj = freelist;
+            freelist = obj->next;
+            return obj;
+        }
+        if (next + objsize > end) {
+            next = (char *)_malloc(SLABPOOL_SLAB_SIZE);
+            end = next + SLABPOOL_SLAB_SIZE;
+        }
+        void *obj = next;
+        next += objsize;
+        return obj;
+    }
+
+    /** @brief Return an object to the pool */
+    void deallocate(void *p) {
+        struct free_object *obj = (struct free_object *)p;
+        obj->next = freelist;
+        freelist = obj;
+    }
+
+    void * allocate_array(size_t size) {
+        return _malloc(size);
+    }
+
+    void deallocate_array(void *p) {
+        _free(p);
+    }
+
+    /** Override: new operator */
+    void * operator new(size_t size) {
+        return _malloc(size);
+    }
+
+    /** Override: delete operator */
+    void operator delete(void *p, size_t size) {
+        _free(p);
+    }
+
+ private:
+    struct free_object {
+        struct free_object *next;
+    };
+
+    /** @brief Freed objects, available for reuse */
+    struct free_object *freelist;
+    /** @brief The next never-used object in the current slab */
+    char *next;
+    /** @brief The end of the current slab */
+    char *end;
+    /** @brief Size of each object, including alignment padding */
+    size_t objsize;
+};
+
+#endif /* __SLABPOOL_H__ */
@@ -8,6 +8,7 @@
 #include "common.h"
 #include "mymemory.h"
 #include "stl-model.h"
+#include "datarace.h"
 
 /* MYBINARYNAME only works because our pathname usually includes 'model' (e.g.,
  * /.../model-checker/test/userprog.o) */
@@ -15,9 +16,11 @@
 #define MAPFILE "/proc/self/maps"
 
 struct snapshot_entry {
-    snapshot_entry(snapshot_id id, int idx) : snapshotid(id), index(idx) { }
+    snapshot_entry(snapshot_id id, int idx, size_t mark) : snapshotid(id), index(idx), racemark(mark) { }
     snapshot_id snapshotid;
     int index;
+    /** @brief The race detector's log mark; see getRaceLogMark() */
+    size_t racemark;
     MEMALLOC
 };
 
@@ -141,7 +144,7 @@ static void SnapshotGlobalSegments()
 int SnapshotStack::backTrackBeforeStep(int seqindex)
 {
     int i;
-    for (i = (int)stack.size() - 1; i >= 0; i++)
+    for (i = (int)stack.size() - 1; i >= 0; i--)
         if (stack[i].index <= seqindex)
             break;
         else
@@ -149,13 +152,14 @@ int SnapshotStack::backTrackBeforeStep(int seqindex)
 
     ASSERT(i >= 0);
     snapshot_roll_back(stack[i].snapshotid);
+    rollBackRaceLog(stack[i].racemark);
     return stack[i].index;
 }
 
 /** This method takes a snapshot at the given sequence number. */
 void SnapshotStack::snapshotStep(int seqindex)
 {
-    stack.push_back(snapshot_entry(take_snapshot(), seqindex));
+    stack.push_back(snapshot_entry(take_snapshot(), seqindex, getRaceLogMark()));
 }
 
 void snapshot_stack_init()
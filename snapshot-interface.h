@@ -16,5 +16,6 @@ void snapshot_system_init(unsigned int numbackingpages,
 void snapshot_stack_init();
 void snapshot_record(int seq_index);
 int snapshot_backtrack_before(int seq_index);
+bool snapshot_has_headroom();
 
 #endif
@@ -13,6 +13,15 @@
 #include "common.h"
 #include "context.h"
 #include "stacktrace.h"
+#include "threads-model.h"
+
+#if USE_MPROTECT_SNAPSHOT == 3
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <linux/userfaultfd.h>
+#endif
 
 /** PageAlignedAdressUpdate return a page aligned address for the
  * address being added as a side effect the numBytes are also changed.
@@ -37,6 +46,11 @@ typedef unsigned char snapshot_page_t[PAGESIZE];
  * know where to copy it to */
 struct BackingPageRecord {
     void *basePtrOfPage;
+#if USE_MPROTECT_SNAPSHOT == 3
+    /** @brief The backing page holding the previous saved version of this
+     *  page, plus one; 0 if there is none */
+    unsigned int prevVersion;
+#endif
 };
 
 /* Struct for each memory region */
@@ -53,14 +67,51 @@ static void * ReturnPageAlignedAddress(void *addr)
     return (void *)(((uintptr_t)addr) & ~(PAGESIZE - 1));
 }
 
+/**
+ * @brief Reserve address space for a growable array
+ *
+ * The memory is only committed as it gets touched.
+ */
+static void * reserve_pages(size_t size)
+{
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    return mem;
+}
+
+/**
+ * @brief Double the size of a reservation made by reserve_pages()
+ *
+ * The array may move. Safe to call from the page fault handler.
+ */
+static void * grow_pages(void *mem, size_t size)
+{
+#ifdef MAC
+    model_print("Out of snapshot memory; rerun with larger -B/-N options\n");
+    exit(EXIT_FAILURE);
+#else
+    mem = mremap(mem, size, 2 * size, MREMAP_MAYMOVE);
+    if (mem == MAP_FAILED) {
+        perror("mremap");
+        exit(EXIT_FAILURE);
+    }
+    return mem;
+#endif
+}
+
 /* Primary struct for snapshotting system */
 struct mprot_snapshotter {
     mprot_snapshotter(unsigned int numbackingpages, unsigned int numsnapshots, unsigned int nummemoryregions);
     ~mprot_snapshotter();
 
+    unsigned int new_backing_page();
+    unsigned int new_snapshot();
+
     struct MemoryRegion *regionsToSnapShot; //This pointer references an array of memory regions to snapshot
     snapshot_page_t *backingStore; //This pointer references an array of snapshotpage's that form the backing store
-    void *backingStoreBasePtr; //This pointer references an array of snapshotpage's that form the backing store
     struct BackingPageRecord *backingRecords; //This pointer references an array of backingpagerecord's (same number of elements as backingstore
     struct SnapShotRecord *snapShots; //This pointer references the snapshot array
 
@@ -69,8 +120,8 @@ struct mprot_snapshotter {
     unsigned int lastRegion; //Stores the next memory region to be used
 
     unsigned int maxRegions; //Stores the max number of memory regions we support
-    unsigned int maxBackingPages; //Stores the total number of backing pages
-    unsigned int maxSnapShots; //Stores the total number of snapshots we allow
+    unsigned int maxBackingPages; //Stores the number of backing pages reserved so far
+    unsigned int maxSnapShots; //Stores the number of snapshot records reserved so far
 
     MEMALLOC
 };
@@ -82,23 +133,44 @@ mprot_snapshotter::mprot_snapshotter(unsigned int backing_pages, unsigned int sn
     lastBackingPage(0),
     lastRegion(0),
     maxRegions(regions),
-    maxBackingPages(backing_pages),
-    maxSnapShots(snapshots)
+    maxBackingPages(backing_pages > 0 ? backing_pages : 1),
+    maxSnapShots(snapshots > 0 ? snapshots : 1)
 {
     regionsToSnapShot = (struct MemoryRegion *)model_malloc(sizeof(struct MemoryRegion) * regions);
-    backingStoreBasePtr = (void *)model_malloc(sizeof(snapshot_page_t) * (backing_pages + 1));
-    //Page align the backingstorepages
-    backingStore = (snapshot_page_t *)PageAlignAddressUpward(backingStoreBasePtr);
-    backingRecords = (struct BackingPageRecord *)model_malloc(sizeof(struct BackingPageRecord) * backing_pages);
-    snapShots = (struct SnapShotRecord *)model_malloc(sizeof(struct SnapShotRecord) * snapshots);
+    backingStore = (snapshot_page_t *)reserve_pages(sizeof(snapshot_page_t) * maxBackingPages);
+    backingRecords = (struct BackingPageRecord *)reserve_pages(sizeof(struct BackingPageRecord) * maxBackingPages);
+    snapShots = (struct SnapShotRecord *)reserve_pages(sizeof(struct SnapShotRecord) * maxSnapShots);
 }
 
 mprot_snapshotter::~mprot_snapshotter()
 {
     model_free(regionsToSnapShot);
-    model_free(backingStoreBasePtr);
-    model_free(backingRecords);
-    model_free(snapShots);
+    munmap(backingStore, sizeof(snapshot_page_t) * maxBackingPages);
+    munmap(backingRecords, sizeof(struct BackingPageRecord) * maxBackingPages);
+    munmap(snapShots, sizeof(struct SnapShotRecord) * maxSnapShots);
+}
+
+/** @return The index of a free backing page, growing the backing store if
+ *  it is full */
+unsigned int mprot_snapshotter::new_backing_page()
+{
+    if (lastBackingPage == maxBackingPages) {
+        backingStore = (snapshot_page_t *)grow_pages(backingStore, sizeof(snapshot_page_t) * maxBackingPages);
+        backingRecords = (struct BackingPageRecord *)grow_pages(backingRecords, sizeof(struct BackingPageRecord) * maxBackingPages);
+        maxBackingPages *= 2;
+    }
+    return lastBackingPage++;
+}
+
+/** @return The index of a free snapshot record, growing the array of records
+ *  if it is full */
+unsigned int mprot_snapshotter::new_snapshot()
+{
+    if (lastSnapShot == maxSnapShots) {
+        snapShots = (struct SnapShotRecord *)grow_pages(snapShots, sizeof(struct SnapShotRecord) * maxSnapShots);
+        maxSnapShots *= 2;
+    }
+    return lastSnapShot++;
 }
 
 /** mprot_handle_pf is the page fault handler for mprotect based snapshotting
@@ -106,7 +178,12 @@ mprot_snapshotter::~mprot_snapshotter()
  */
 static void mprot_handle_pf(int sig, siginfo_t *si, void *unused)
 {
-    if (si->si_code == SEGV_MAPERR) {
+    if (stack_guard_hit(si->si_addr)) {
+        model_print("Thread stack overflow at %p; increase STACK_SIZE in config.h\n", si->si_addr);
+        exit(EXIT_FAILURE);
+    }
+    /* The userfaultfd backend never takes write faults on snapshotted pages */
+    if (si->si_code == SEGV_MAPERR || USE_MPROTECT_SNAPSHOT == 3) {
         model_print("Segmentation fault at %p\n", si->si_addr);
         model_print("For debugging, place breakpoint at: %s:%d\n",
                 __FILE__, __LINE__);
@@ -116,11 +193,7 @@ static void mprot_handle_pf(int sig, siginfo_t *si, void *unused)
     }
     void* addr = ReturnPageAlignedAddress(si->si_addr);
 
-    unsigned int backingpage = mprot_snap->lastBackingPage++; //Could run out of pages...
-    if (backingpage == mprot_snap->maxBackingPages) {
-        model_print("Out of backing pages at %p\n", si->si_addr);
-        exit(EXIT_FAILURE);
-    }
+    unsigned int backingpage = mprot_snap->new_backing_page();
 
     //copy page
     memcpy(&(mprot_snap->backingStore[backingpage]), addr, sizeof(snapshot_page_t));
@@ -133,6 +206,10 @@ static void mprot_handle_pf(int sig, siginfo_t *si, void *unused)
     }
 }
 
+/** @brief The memory backing user_snapshot_space */
+static void *user_heap_base;
+static size_t user_heap_size;
+
 static void mprot_snapshot_init(unsigned int numbackingpages,
         unsigned int numsnapshots, unsigned int nummemoryregions,
         unsigned int numheappages, VoidFuncPtr entryPoint)
@@ -161,6 +238,7 @@ static void mprot_snapshot_init(unsigned int numbackingpages,
 
     mprot_snap = new mprot_snapshotter(numbackingpages, numsnapshots, nummemoryregions);
 
+#if USE_MPROTECT_SNAPSHOT != 3
     // EVIL HACK: We need to make sure that calls into the mprot_handle_pf method don't cause dynamic links
     // The problem is that we end up protecting state in the dynamic linker...
     // Solution is to call our signal handler before we start protecting stuff...
@@ -170,11 +248,14 @@ static void mprot_snapshot_init(unsigned int numbackingpages,
     si.si_addr = ss.ss_sp;
     mprot_handle_pf(SIGSEGV, &si, NULL);
     mprot_snap->lastBackingPage--; //remove the fake page we copied
+#endif
 
     void *basemySpace = model_malloc((numheappages + 1) * PAGESIZE);
     void *pagealignedbase = PageAlignAddressUpward(basemySpace);
     user_snapshot_space = create_mspace_with_base(pagealignedbase, numheappages * PAGESIZE, 1);
     snapshot_add_memory_region(pagealignedbase, numheappages);
+    user_heap_base = pagealignedbase;
+    user_heap_size = numheappages * PAGESIZE;
 
     void *base_model_snapshot_space = model_malloc((numheappages + 1) * PAGESIZE);
     pagealignedbase = PageAlignAddressUpward(base_model_snapshot_space);
@@ -184,11 +265,15 @@ static void mprot_snapshot_init(unsigned int numbackingpages,
     entryPoint();
 }
 
+#if USE_MPROTECT_SNAPSHOT == 3
+static void uffd_add_region(struct MemoryRegion *region);
+#endif
+
 static void mprot_add_to_snapshot(void *addr, unsigned int numPages)
 {
     unsigned int memoryregion = mprot_snap->lastRegion++;
     if (memoryregion == mprot_snap->maxRegions) {
-        model_print("Exceeded supported number of memory regions!\n");
+        model_print("Exceeded supported number of memory regions! Rerun with a larger -R option\n");
         exit(EXIT_FAILURE);
     }
 
@@ -197,10 +282,266 @@ static void mprot_add_to_snapshot(void *addr, unsigned int numPages)
             numPages > 1 ? "s" : "");
     mprot_snap->regionsToSnapShot[memoryregion].basePtr = addr;
     mprot_snap->regionsToSnapShot[memoryregion].sizeInPages = numPages;
+#if USE_MPROTECT_SNAPSHOT == 3
+    uffd_add_region(&mprot_snap->regionsToSnapShot[memoryregion]);
+#endif
+}
+
+#if USE_MPROTECT_SNAPSHOT == 3
+
+/*
+ * Instead of taking a write fault on the first write to each page after a
+ * snapshot, the kernel tracks written pages for us (asynchronous userfaultfd
+ * write-protection) and we collect them with the PAGEMAP_SCAN ioctl. As we
+ * only learn about a write after the fact, each snapshot saves the new
+ * contents of the pages written since the previous snapshot; rolling back
+ * restores the latest version saved up to the target snapshot.
+ */
+
+/* Older kernel headers lack the PAGEMAP_SCAN interface (Linux 6.7) */
+#ifndef PAGEMAP_SCAN
+#define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#define UFFD_FEATURE_WP_ASYNC (1 << 15)
+
+#define PAGE_IS_WRITTEN (1 << 1)
+#define PAGE_IS_PRESENT (1 << 3)
+#define PAGE_IS_SWAPPED (1 << 4)
+
+#define PM_SCAN_WP_MATCHING (1 << 0)
+#define PM_SCAN_CHECK_WPASYNC (1 << 1)
+
+struct page_region {
+    __u64 start;
+    __u64 end;
+    __u64 categories;
+};
+
+struct pm_scan_arg {
+    __u64 size;
+    __u64 flags;
+    __u64 start;
+    __u64 end;
+    __u64 walk_end;
+    __u64 vec;
+    __u64 vec_len;
+    __u64 max_pages;
+    __u64 category_inverted;
+    __u64 category_mask;
+    __u64 category_anyof_mask;
+    __u64 return_mask;
+};
+
+#define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+#endif
+
+/** @brief Number of page ranges fetched per PAGEMAP_SCAN call */
+#define UFFD_SCAN_BATCH 64
+
+static int uffd = -1;
+static int pagemap_fd = -1;
+
+/** @brief Maps each saved page to its latest version in the backing store
+ *  (plus one) */
+static HashTable<void *, unsigned int, uintptr_t, 4, model_malloc, model_calloc, model_free> *page_versions;
+
+/**
+ * @brief Move a file-backed memory region (i.e., the program's globals) to
+ * anonymous memory, which userfaultfd can write-protect
+ */
+static void uffd_make_anonymous(void *addr, size_t size)
+{
+    void *copy = model_malloc(size);
+    memcpy(copy, addr, size);
+    if (mmap(addr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(addr, copy, size);
+    model_free(copy);
+}
+
+/** @brief Start tracking writes to a memory region */
+static void uffd_register_region(struct MemoryRegion *region)
+{
+    size_t size = region->sizeInPages * sizeof(snapshot_page_t);
+    struct uffdio_register reg;
+    reg.range.start = (uintptr_t)region->basePtr;
+    reg.range.len = size;
+    reg.mode = UFFDIO_REGISTER_MODE_WP;
+    if (ioctl(uffd, UFFDIO_REGISTER, &reg) == -1) {
+        uffd_make_anonymous(region->basePtr, size);
+        if (ioctl(uffd, UFFDIO_REGISTER, &reg) == -1) {
+            perror("UFFDIO_REGISTER");
+            exit(EXIT_FAILURE);
+        }
+    }
+    /* Written pages are tracked per page table entry; avoid 2MB entries */
+    madvise(region->basePtr, size, MADV_NOHUGEPAGE);
+
+    struct uffdio_writeprotect wp;
+    wp.range = reg.range;
+    wp.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+    if (ioctl(uffd, UFFDIO_WRITEPROTECT, &wp) == -1) {
+        perror("UFFDIO_WRITEPROTECT");
+        exit(EXIT_FAILURE);
+    }
 }
 
+/** @brief Start tracking writes to a region added after the first snapshot */
+static void uffd_add_region(struct MemoryRegion *region)
+{
+    /* Until then, uffd_init() registers all regions at once */
+    if (uffd != -1)
+        uffd_register_region(region);
+}
+
+/**
+ * @brief Set up write tracking for all snapshotted regions
+ *
+ * Deferred to the first snapshot, as write-protection does not survive
+ * fork() (see --jobs).
+ */
+static void uffd_init()
+{
+    uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+    if (uffd == -1) {
+        perror("userfaultfd");
+        exit(EXIT_FAILURE);
+    }
+    struct uffdio_api api;
+    api.api = UFFD_API;
+    api.features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED;
+    if (ioctl(uffd, UFFDIO_API, &api) == -1) {
+        perror("UFFDIO_API");
+        model_print("Asynchronous userfaultfd write-protection needs Linux 6.7; set USE_MPROTECT_SNAPSHOT to 2 in config.h\n");
+        exit(EXIT_FAILURE);
+    }
+    pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+    if (pagemap_fd == -1) {
+        perror("open(/proc/self/pagemap)");
+        exit(EXIT_FAILURE);
+    }
+    page_versions = new HashTable<void *, unsigned int, uintptr_t, 4, model_malloc, model_calloc, model_free>();
+
+    for (unsigned int region = 0; region < mprot_snap->lastRegion; region++)
+        uffd_register_region(&mprot_snap->regionsToSnapShot[region]);
+}
+
+/**
+ * @brief Visit the pages of all snapshotted regions which were written since
+ * the last scan, and write-protect them again
+ * @param visit Called on each page; may be NULL
+ * @param present Visit all present pages instead, written or not
+ */
+static void uffd_scan_pages(void (*visit)(void *), bool present)
+{
+    struct page_region vec[UFFD_SCAN_BATCH];
+    struct pm_scan_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.size = sizeof(arg);
+    arg.flags = PM_SCAN_WP_MATCHING | PM_SCAN_CHECK_WPASYNC;
+    arg.vec = (uintptr_t)vec;
+    arg.vec_len = UFFD_SCAN_BATCH;
+    if (present)
+        arg.category_anyof_mask = PAGE_IS_PRESENT | PAGE_IS_SWAPPED;
+    else
+        arg.category_mask = PAGE_IS_WRITTEN;
+    arg.return_mask = PAGE_IS_WRITTEN | PAGE_IS_PRESENT | PAGE_IS_SWAPPED;
+
+    for (unsigned int region = 0; region < mprot_snap->lastRegion; region++) {
+        struct MemoryRegion *r = &mprot_snap->regionsToSnapShot[region];
+        arg.start = (uintptr_t)r->basePtr;
+        arg.end = arg.start + r->sizeInPages * sizeof(snapshot_page_t);
+        while (arg.start < arg.end) {
+            int num = ioctl(pagemap_fd, PAGEMAP_SCAN, &arg);
+            if (num < 0) {
+                perror("PAGEMAP_SCAN");
+                exit(EXIT_FAILURE);
+            }
+            for (int i = 0; visit && i < num; i++)
+                for (uintptr_t page = vec[i].start; page < vec[i].end; page += PAGESIZE)
+                    visit((void *)page);
+            arg.start = arg.walk_end;
+        }
+    }
+}
+
+/** @brief Save the current contents of a page as part of the latest snapshot */
+static void uffd_save_page(void *addr)
+{
+    unsigned int backingpage = mprot_snap->new_backing_page();
+    memcpy(&mprot_snap->backingStore[backingpage], addr, sizeof(snapshot_page_t));
+    mprot_snap->backingRecords[backingpage].basePtrOfPage = addr;
+    mprot_snap->backingRecords[backingpage].prevVersion = page_versions->get(addr);
+    page_versions->put(addr, backingpage + 1);
+}
+
+static snapshot_id uffd_take_snapshot()
+{
+    unsigned int snapshot = mprot_snap->new_snapshot();
+    mprot_snap->snapShots[snapshot].firstBackingPage = mprot_snap->lastBackingPage;
+
+    /* The first snapshot saves every page we may have to restore later */
+    if (uffd == -1)
+        uffd_init();
+    uffd_scan_pages(uffd_save_page, snapshot == 0);
+
+    return snapshot;
+}
+
+/** @brief Pages to restore in uffd_roll_back() */
+static ModelVector<void *> *dirty_pages;
+static HashTable<void *, bool, uintptr_t, 4, model_malloc, model_calloc, model_free> *dirty_map;
+
+static void uffd_mark_dirty(void *addr)
+{
+    if (!dirty_map->contains(addr)) {
+        dirty_map->put(addr, true);
+        dirty_pages->push_back(addr);
+    }
+}
+
+static void uffd_roll_back(snapshot_id theID)
+{
+    ModelVector<void *> pages;
+    HashTable<void *, bool, uintptr_t, 4, model_malloc, model_calloc, model_free> map;
+    dirty_pages = &pages;
+    dirty_map = &map;
+
+    /* Pages written since the latest snapshot... */
+    uffd_scan_pages(uffd_mark_dirty, false);
+
+    /* ...and those saved by the snapshots we discard */
+    if (theID + 1 < mprot_snap->lastSnapShot) {
+        unsigned int first = mprot_snap->snapShots[theID + 1].firstBackingPage;
+        for (unsigned int page = mprot_snap->lastBackingPage; page-- > first; ) {
+            struct BackingPageRecord *record = &mprot_snap->backingRecords[page];
+            page_versions->put(record->basePtrOfPage, record->prevVersion);
+            uffd_mark_dirty(record->basePtrOfPage);
+        }
+        mprot_snap->lastBackingPage = first;
+        mprot_snap->lastSnapShot = theID + 1;
+    }
+
+    for (unsigned int i = 0; i < pages.size(); i++) {
+        unsigned int version = page_versions->get(pages[i]);
+        /* Never saved: the page was not populated at the first snapshot */
+        if (version)
+            memcpy(pages[i], &mprot_snap->backingStore[version - 1], sizeof(snapshot_page_t));
+        else
+            memset(pages[i], 0, sizeof(snapshot_page_t));
+    }
+    /* Restoring wrote to the pages; they match the snapshot again */
+    uffd_scan_pages(NULL, false);
+}
+
+#endif /* USE_MPROTECT_SNAPSHOT == 3 */
+
 static snapshot_id mprot_take_snapshot()
 {
+#if USE_MPROTECT_SNAPSHOT == 3
+    return uffd_take_snapshot();
+#else
     for (unsigned int region = 0; region < mprot_snap->lastRegion; region++) {
         if (mprotect(mprot_snap->regionsToSnapShot[region].basePtr, mprot_snap->regionsToSnapShot[region].sizeInPages * sizeof(snapshot_page_t), PROT_READ) == -1) {
             perror("mprotect");
@@ -208,18 +549,27 @@ static snapshot_id mprot_take_snapshot()
             exit(EXIT_FAILURE);
         }
     }
-    unsigned int snapshot = mprot_snap->lastSnapShot++;
-    if (snapshot == mprot_snap->maxSnapShots) {
-        model_print("Out of snapshots\n");
-        exit(EXIT_FAILURE);
-    }
+    unsigned int snapshot = mprot_snap->new_snapshot();
     mprot_snap->snapShots[snapshot].firstBackingPage = mprot_snap->lastBackingPage;
 
     return snapshot;
+#endif
+}
+
+static bool mprot_has_headroom()
+{
+    /* The backing store grows as needed, but optional snapshots should not
+     * be the reason it does: keep half of it for the tail of the execution */
+    return mprot_snap->lastBackingPage < mprot_snap->maxBackingPages / 2 &&
+        mprot_snap->lastSnapShot + 1 < mprot_snap->maxSnapShots;
 }
 
 static void mprot_roll_back(snapshot_id theID)
 {
+#if USE_MPROTECT_SNAPSHOT == 3
+    uffd_roll_back(theID);
+    return;
+#endif
 #if USE_MPROTECT_SNAPSHOT == 2
     if (mprot_snap->lastSnapShot == (theID + 1)) {
         for (unsigned int page = mprot_snap->snapShots[theID].firstBackingPage; page < mprot_snap->lastBackingPage; page++) {
@@ -443,6 +793,19 @@ void snapshot_system_init(unsigned int numbackingpages,
 #endif
 }
 
+#if USE_MPROTECT_SNAPSHOT
+/**
+ * @brief Get the memory from which user allocations are served
+ * @param base Set to the first byte of the user heap
+ * @param size Set to the size of the user heap, in bytes
+ */
+void snapshot_get_user_heap(void **base, size_t *size)
+{
+    *base = user_heap_base;
+    *size = user_heap_size;
+}
+#endif
+
 /** Assumes that addr is page aligned. */
 void snapshot_add_memory_region(void *addr, unsigned int numPages)
 {
@@ -465,6 +828,23 @@ snapshot_id take_snapshot()
 #endif
 }
 
+/**
+ * @brief Check whether an extra snapshot may be taken at this point
+ *
+ * Every snapshot may duplicate pages already held by its predecessors, so
+ * optional (mid-execution) snapshots should only be taken while the snapshot
+ * system still has plenty of room left.
+ * @return True if an optional snapshot is affordable
+ */
+bool snapshot_has_headroom()
+{
+#if USE_MPROTECT_SNAPSHOT
+    return mprot_has_headroom();
+#else
+    return true;
+#endif
+}
+
 /** Rolls the memory state back to the given snapshot identifier.
  *  @param theID is the snapshot identifier to rollback to.
  */
@@ -13,7 +13,9 @@ void snapshot_add_memory_region(void *ptr, unsigned int numPages);
 snapshot_id take_snapshot();
 void snapshot_roll_back(snapshot_id theSnapShot);
 
-#if !USE_MPROTECT_SNAPSHOT
+#if USE_MPROTECT_SNAPSHOT
+void snapshot_get_user_heap(void **base, size_t *size);
+#else
 mspace create_shared_mspace();
 #endif
 
@@ -10,7 +10,12 @@
 #include <iterator>
 #include "modeltypes.h"
 #include "model-assert.h"
+#include "config.h"
 #include "time.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 /********************    PotentialOP    ********************/
 PotentialOP::PotentialOP(ModelAction *op, CSTR label) :
@@ -29,6 +34,12 @@ PotentialOP::PotentialOP(ModelAction *op, CSTR label) :
 ExecutionGraph::ExecutionGraph(ModelExecution *e, bool allowCyclic) : execution(e), allowCyclic(allowCyclic) {
     methodList = new MethodList;
     randomHistory = NULL;
+    prefixStates = NULL;
+    numWorkers = 0;
+    workerId = -1;
+    workerLevel = -1;
+    workerStop = NULL;
+    workerStopped = false;
 
     broken = false;
     noOrderingPoint = false;
@@ -243,21 +254,46 @@ bool ExecutionGraph::checkRandomHistories(int num, bool stopOnFail, bool verbose
     
     If stopOnFailure is true, we stop generating any history and end the
     checking process. Verbose flag controls how the checking process is exposed. 
+    With more than one job, worker processes check the histories from the
+    first point where they branch.
 */
-bool ExecutionGraph::checkAllHistories(bool stopOnFailure, bool verbose) {
+bool ExecutionGraph::checkAllHistories(bool stopOnFailure, bool verbose, int
+    jobs) {
     ASSERT (!cyclic);
-    MethodList *curList = new MethodList;
+    MethodList *history = new MethodList;
+    MethodSet sleep = new SnapSet<Method>;
     int numLiveNodes = methodList->size();
     int historyIndex = 1;
     if (verbose) {
         // Print out the graph in verbose
         print();
+    } else {
+        // The states after each prefix of the history, starting from @Initial
+        prefixStates = new MethodVector;
+        for (int i = 0; i <= numLiveNodes; i++)
+            prefixStates->push_back(new MethodCall(GRAPH_START));
+        UpdateState_t initialFunc = (UpdateState_t) initial->function;
+        (*initialFunc)((*prefixStates)[0]);
     }
     
     // FIXME: make stopOnFailure always true
     stopOnFailure = true;
-    bool pass = checkAllHistoriesHelper(curList, numLiveNodes, historyIndex,
-        stopOnFailure, verbose);
+    numWorkers = jobs;
+    bool pass = checkAllHistoriesHelper(history, sleep, numLiveNodes,
+        historyIndex, stopOnFailure, verbose);
+    delete history;
+    delete sleep;
+    if (prefixStates) {
+        UpdateState_t clearFunc = (UpdateState_t) clear->function;
+        for (unsigned i = 0; i < prefixStates->size(); i++) {
+            Method state = (*prefixStates)[i];
+            if (state->state)
+                (*clearFunc)(state);
+            delete state;
+        }
+        delete prefixStates;
+        prefixStates = NULL;
+    }
     if (pass) {
         for (MethodList::iterator it = methodList->begin(); it !=
             methodList->end(); it++) {
@@ -1019,18 +1055,30 @@ MethodVector* ExecutionGraph::getEndNodes() {
 }
 
 /**
-    This is a helper function for generating all the topological sortings of the
+    This is a helper function for checking all the topological sortings of the
     execution graph. The idea of this function is recursively do the following
     process: logically mark whether a method call node is alive or not
     (initially all are alive), find a list of nodes that are root nodes (that
-    have no incoming edges), continuously pick one node in that list, add it to the curList
-    (which stores one topological sorting), and then recursively call itself to
-    resolve the rest.
+    have no incoming edges), continuously pick one node in that list, append it
+    to the history (which is extended in place to each topological sorting),
+    and then recursively call itself to resolve the rest.
+
+    Unless in verbose mode, each method call is checked as soon as it is
+    appended, on the state of the sequential data structure after the rest of
+    the history (see checkHistoryPrefix()); a prefix shared by many histories
+    is thus only checked once. In verbose mode, we check (and print out) each
+    whole history from the @Initial state.
+
+    When two root nodes commute (by the commutativity rules), picking one
+    before the other leads to the same states as the other way around, so we
+    only try one of the two orders: the nodes in the sleep set have been
+    picked before a commuting node in an earlier iteration, and we do not pick
+    them again until a node that they do not commute with is picked.
     
     Arguments:
-    curList -> It represents a temporal result of a specific topological
-        sorting; keep in mind that before calling this function, pass an empty
-        list. 
+    history -> The history so far; keep in mind that before calling this
+        function, pass an empty list. 
+    sleep -> The root nodes not to pick now; pass an empty set at first.
     numLiveNodes -> The number of nodes that are logically alive (that have not
         been selected and added in a specific topological sorting yet). We keep
         such a number as an optimization since when numLinveNodes equals to 0,
@@ -1039,18 +1087,24 @@ MethodVector* ExecutionGraph::getEndNodes() {
     stopOnFailure -> Stop the checking once we see a failed history
     verbose -> Whether the verbose mode is on
 */
-bool ExecutionGraph::checkAllHistoriesHelper(MethodList *curList, int
-    &numLiveNodes, int &historyIndex, bool stopOnFailure, bool verbose) {
+bool ExecutionGraph::checkAllHistoriesHelper(MethodList *history, MethodSet
+    sleep, int &numLiveNodes, int &historyIndex, bool stopOnFailure, bool
+    verbose) {
     if (cyclic)
         return false;
+    // Another worker process has failed
+    if (workerStop && *workerStop) {
+        workerStopped = true;
+        return false;
+    }
     
-    bool satisfied = true;
     if (numLiveNodes == 0) { // Found one sorting, and we can backtrack
         // Don't forget to increase the history number
-        satisfied = checkStateSpec(curList, verbose, historyIndex++);
-        // Don't forget to recycle
-        delete curList;
-        return satisfied;
+        if (verbose)
+            return checkStateSpec(history, verbose, historyIndex++);
+        // Its method calls have been checked when appended
+        historyIndex++;
+        return true;
     }
 
     MethodVector *roots = getRootNodes();
@@ -1059,37 +1113,251 @@ bool ExecutionGraph::checkAllHistoriesHelper(MethodList *curList, int
         model_print("There is a cycle in this graph so we cannot generate"
             " sequential histories\n");
         cyclic = true;
+        delete roots;
         return false;
     }
 
+#if USE_MPROTECT_SNAPSHOT
+    // Distribute the branches at the first choice among worker processes
+    // (fork-based snapshotting shares the stack and model heap with them)
+    if (numWorkers > 1 && workerId < 0) {
+        unsigned numBranches = 0;
+        for (unsigned i = 0; i < roots->size(); i++) {
+            if (!MethodCall::belong(sleep, (*roots)[i]))
+                numBranches++;
+        }
+        if (numBranches > 1) {
+            delete roots;
+            return checkBranchesInWorkers(history, sleep, numLiveNodes,
+                historyIndex, stopOnFailure, verbose);
+        }
+    }
+#endif
+
+    bool satisfied = true;
+    int branch = 0;
+    // The sleeping nodes and the nodes picked in the earlier iterations
+    MethodSet picked = new SnapSet<Method>(*sleep);
     for (unsigned i = 0; i < roots->size(); i++) {
         Method m = (*roots)[i];
+        if (MethodCall::belong(sleep, m))
+            continue;
+        // Another worker process checks this branch
+        if (workerId >= 0 && workerLevel == (int) history->size() &&
+            branch++ % numWorkers != workerId) {
+            picked->insert(m);
+            continue;
+        }
+        MethodSet nextSleep = new SnapSet<Method>;
+        for (SnapSet<Method>::iterator it = picked->begin(); it !=
+            picked->end(); it++) {
+            if (commute(*it, m))
+                nextSleep->insert(*it);
+        }
+
         m->exist = false;
         numLiveNodes--;
-        // Copy the whole current list and use that copy for the next recursive
-        // call (because we will need the same copy for other iterations at the
-        // same level of recursive calls)
-        MethodList *newList = new MethodList(*curList);
-        newList->push_back(m);
+        history->push_back(m);
         
-        bool oneSatisfied = checkAllHistoriesHelper(newList, numLiveNodes,
-            historyIndex, stopOnFailure, verbose);
+        bool oneSatisfied = verbose || checkHistoryPrefix(history);
+        if (oneSatisfied)
+            oneSatisfied = checkAllHistoriesHelper(history, nextSleep,
+                numLiveNodes, historyIndex, stopOnFailure, verbose);
+        delete nextSleep;
         // Stop the checking once failure or cycle detected
         if (!oneSatisfied && (cyclic || stopOnFailure)) {
-            delete curList;
+            delete picked;
             delete roots;
             return false;
         }
         satisfied &= oneSatisfied;
         // Recover
+        history->pop_back();
         m->exist = true;
         numLiveNodes++;
+        picked->insert(m);
     }
-    delete curList;
+    delete picked;
     delete roots;
     return satisfied;
 }
 
+/**
+    What a history-checking worker process has found, in memory shared with
+    the model checker; followed by the justified flags of the method calls (in
+    the order of methodList)
+*/
+struct history_worker_result {
+    /** Whether the worker has checked all of its branches */
+    bool done;
+    bool satisfied;
+    bool cyclic;
+    /** The number of histories checked */
+    int histories;
+};
+
+/**
+    Check the histories extending the current one in numWorkers worker
+    processes, each taking every numWorkers-th of the branches from here on
+    (see checkAllHistoriesHelper()). The workers print out to their own
+    buffers, which we copy to our output in order, and number their histories
+    from 1. A worker that cannot be started has its branches checked here
+    instead. With stopOnFailure, the first failed history stops all the
+    workers.
+*/
+bool ExecutionGraph::checkBranchesInWorkers(MethodList *history, MethodSet
+    sleep, int &numLiveNodes, int &historyIndex, bool stopOnFailure, bool
+    verbose) {
+    size_t resultSize = sizeof(struct history_worker_result) +
+        methodList->size();
+    char *shared = (char *) mmap(NULL, sizeof(int) + numWorkers * resultSize,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        numWorkers = 0;
+        return checkAllHistoriesHelper(history, sleep, numLiveNodes,
+            historyIndex, stopOnFailure, verbose);
+    }
+    workerStop = (volatile int *) shared;
+    int *outfds = (int *) model_calloc(numWorkers, sizeof(int));
+    pid_t *pids = (pid_t *) model_calloc(numWorkers, sizeof(pid_t));
+
+    for (int k = 0; k < numWorkers; k++) {
+        struct history_worker_result *result = (struct history_worker_result *)
+            (shared + sizeof(int) + k * resultSize);
+        outfds[k] = memfd_create("history-output", MFD_CLOEXEC);
+        if (outfds[k] < 0) {
+            perror("memfd_create");
+            pids[k] = -1;
+            continue;
+        }
+        pids[k] = fork();
+        if (pids[k] < 0) {
+            perror("fork");
+        } else if (pids[k] == 0) {
+            model_out = outfds[k];
+            int index = 1;
+            bool satisfied = checkBranchesOfWorker(k, history, sleep,
+                numLiveNodes, index, stopOnFailure, verbose);
+            result->satisfied = satisfied;
+            result->cyclic = cyclic;
+            result->histories = index - 1;
+            char *justified = (char *) (result + 1);
+            for (MethodList::iterator it = methodList->begin(); it !=
+                methodList->end(); it++)
+                *justified++ = (*it)->justified;
+            result->done = !workerStopped;
+            exit_worker();
+        }
+    }
+
+    bool satisfied = true;
+    for (int k = 0; k < numWorkers; k++) {
+        struct history_worker_result *result = (struct history_worker_result *)
+            (shared + sizeof(int) + k * resultSize);
+        int status = 0;
+        if (pids[k] < 0) {
+            // Check its branches here, then carry on with the others
+            int index = 1;
+            satisfied &= checkBranchesOfWorker(k, history, sleep,
+                numLiveNodes, index, stopOnFailure, verbose);
+            historyIndex += index - 1;
+            workerStopped = false;
+        } else {
+            wait_worker(pids[k], &status, true);
+            flush_worker_output(outfds[k]);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                model_print("A history-checking process failed\n");
+                satisfied = false;
+            } else if (result->done) {
+                satisfied &= result->satisfied;
+                cyclic |= result->cyclic;
+                historyIndex += result->histories;
+                char *justified = (char *) (result + 1);
+                for (MethodList::iterator it = methodList->begin(); it !=
+                    methodList->end(); it++, justified++) {
+                    if (*justified)
+                        (*it)->justified = true;
+                }
+            }
+        }
+        if (outfds[k] >= 0)
+            close(outfds[k]);
+    }
+    // Stopped workers mean that another one has failed
+    if (*workerStop)
+        satisfied = false;
+
+    model_free(pids);
+    model_free(outfds);
+    munmap(shared, sizeof(int) + numWorkers * resultSize);
+    workerStop = NULL;
+    return satisfied;
+}
+
+/**
+    Check the branches of worker k (see checkBranchesInWorkers()), numbering
+    its histories from historyIndex, and stop the other workers if one of them
+    fails
+*/
+bool ExecutionGraph::checkBranchesOfWorker(int k, MethodList *history,
+    MethodSet sleep, int &numLiveNodes, int &historyIndex, bool
+    stopOnFailure, bool verbose) {
+    if (verbose)
+        model_print("---- Histories of worker #%d ----\n", k);
+    workerId = k;
+    workerLevel = history->size();
+    bool satisfied = checkAllHistoriesHelper(history, sleep, numLiveNodes,
+        historyIndex, stopOnFailure, verbose);
+    workerId = -1;
+    workerLevel = -1;
+    if (!satisfied && !workerStopped && stopOnFailure)
+        *workerStop = 1;
+    return satisfied;
+}
+
+/**
+    Check the method call just appended to the history on the state after the
+    rest of the history, and keep the resulting state for the histories that
+    extend this one
+*/
+bool ExecutionGraph::checkHistoryPrefix(MethodList *history) {
+    UpdateState_t clearFunc = (UpdateState_t) clear->function;
+    CopyState_t copyFunc = (CopyState_t) copy->function;
+    Method m = history->back();
+    Method state = (*prefixStates)[history->size()];
+
+    if (state->state) {
+        (*clearFunc)(state);
+        state->state = NULL;
+    }
+    (*copyFunc)(state, (*prefixStates)[history->size() - 1]);
+    if (isFakeMethod(m))
+        return true;
+
+    if (!checkMethodSpec(state, m, history, false, 0))
+        return false;
+    justifyMethod(history, m, false, 0);
+    return true;
+}
+
+/**
+    Whether the commutativity rules say that method calls m1 and m2 commute,
+    i.e., there is a rule for them and their ordering does not matter
+*/
+bool ExecutionGraph::commute(Method m1, Method m2) {
+    bool commute = false;
+    for (int i = 0; i < commuteRuleNum; i++) {
+        CommutativityRule rule = *(commuteRules + i);
+        if (!rule.isRightRule(m1, m2)) // Not this rule
+            continue;
+        if (!rule.checkCondition(m1, m2))
+            return false;
+        commute = true;
+    }
+    return commute;
+}
+
 /** To check one generated history */
 bool ExecutionGraph::checkHistory(MethodList *history, int historyIndex, bool
     verbose) {
@@ -1254,101 +1522,16 @@ bool ExecutionGraph::checkStateSpec(MethodList *history, bool verbose, int
         }
     }
     
-    StateFunctions *funcs = NULL;
     /** Execute each method call in the history */
     for (MethodList::iterator it = history->begin(); it != history->end();
         it++) {
         Method m = *it;
         if (isFakeMethod(m))
             continue;
-    
-        StateTransition_t transition = NULL;
-        
-        if (verbose) {
-            m->print(false, true);
-            funcs = funcMap->get(m->name);
-            ASSERT (funcs);
-            UpdateState_t printValue = (UpdateState_t) funcs->print->function;
-            if (printValue) {
-                model_print("\t**********  Value Info  **********\n");
-                (*printValue)(m);
-            }
-        }
-
-        funcs = funcMap->get(m->name);
-        ASSERT (funcs);
-
-        CheckState_t preCondition = (CheckState_t)
-            funcs->preCondition->function;
-        // @PreCondition of Mehtod m
-        if (preCondition) {
-            satisfied = (*preCondition)(startMethod, m);
-
-            if (!satisfied) {
-                model_print("PreCondition is not satisfied. Problematic method"
-                    " is as follow: \n");
-                m->print(true, true);
-                printOneHistory(history, "Failed History");
-                if (verbose) {
-                    if (historyIndex > 0)
-                        model_print("---- Check history #%d END ----\n\n",
-                            historyIndex);
-                    else
-                        model_print("---- Check history END ----\n\n");
-                }
-                break;
-            }
-        }
-
-        // After checking the PreCondition, we run the transition on the
-        // startMethod node to update its state
-        transition = (StateTransition_t) funcs->transition->function;
-        // @Transition on the state of startMethod
-        satisfied = (*transition)(startMethod, m);
-        if (!satisfied) { // Error in evaluating @Transition
-            model_print("Transition returns false. Problematic method"
-                " is as follow: \n");
-            m->print(true, true);
-            printOneHistory(history, "Failed History");
-            if (verbose) {
-                if (historyIndex > 0)
-                    model_print("---- Check history #%d END ----\n\n",
-                        historyIndex);
-                else
-                    model_print("---- Check history END ----\n\n");
-            }
+        satisfied = checkMethodSpec(startMethod, m, history, verbose,
+            historyIndex);
+        if (!satisfied)
             break;
-        }
-
-        if (verbose) {
-            model_print("\t@Transition on itself\n");
-            if (printStateFunc) {
-                model_print("\t**********  State Info  **********\n");
-                (*printStateFunc)(startMethod);
-            }
-        }
-        
-        // @PostCondition of Mehtod m
-        CheckState_t postCondition = (CheckState_t)
-            funcs->postCondition->function;
-        if (postCondition) {
-            satisfied = (*postCondition)(startMethod, m);
-
-            if (!satisfied) {
-                model_print("PostCondition is not satisfied. Problematic method"
-                    " is as follow: \n");
-                m->print(true, true);
-                printOneHistory(history, "Failed History");
-                if (verbose) {
-                    if (historyIndex > 0)
-                        model_print("---- Check history #%d END ----\n\n",
-                            historyIndex);
-                    else
-                        model_print("---- Check history END ----\n\n");
-                }
-                break;
-            }
-        }
     }
 
     // Clear out the states created when checking
@@ -1375,46 +1558,7 @@ bool ExecutionGraph::checkStateSpec(MethodList *history, bool verbose, int
         Method m = *it;
         if (isFakeMethod(m))
             continue;
-        // Check justifying subhistory
-        if (!m->justified) {
-            funcs = funcMap->get(m->name);
-            CheckState_t justifyingPrecondition = (CheckState_t)
-                funcs->justifyingPrecondition->function;
-            CheckState_t justifyingPostcondition = (CheckState_t)
-                funcs->justifyingPostcondition->function;
-            if (!justifyingPrecondition && !justifyingPostcondition ) {
-                // No need to check justifying conditions
-                m->justified = true;
-                if (verbose) {
-                    model_print("\tMethod call  ");
-                    m->print(false, false);
-                    model_print(": automatically justified.\n");
-                }
-            } else {
-                bool justified = checkJustifyingSubhistory(history, m, verbose, historyIndex);
-                if (justified) {
-                    // Set the "justified" flag --- no need to check again for cur
-                    m->justified = true;
-                    if (verbose) {
-                        model_print("\tMethod call  ");
-                        m->print(false, false);
-                        model_print(": is justified\n");
-                    }
-                } else {
-                    if (verbose) {
-                        model_print("\tMethod call  ");
-                        m->print(false, false);
-                        model_print(": has NOT been justified yet\n");
-                    }
-                }
-            }
-        } else {
-            if (verbose) {
-                model_print("\tMethod call  ");
-                m->print(false, false);
-                model_print(": is justified\n");
-            }
-        }
+        justifyMethod(history, m, verbose, historyIndex);
     }
     if (verbose) {
         if (historyIndex > 0)
@@ -1427,6 +1571,155 @@ bool ExecutionGraph::checkStateSpec(MethodList *history, bool verbose, int
     return satisfied;
 }
 
+/**
+    Execute method call m on a state of the sequential data structure:
+    checking its @PreCondition, running its @Transition and then checking its
+    @PostCondition. The history is only printed out on failure.
+*/
+bool ExecutionGraph::checkMethodSpec(Method state, Method m, MethodList
+    *history, bool verbose, int historyIndex) {
+    bool satisfied = true;
+    UpdateState_t printStateFunc = (UpdateState_t) printState->function;
+    StateFunctions *funcs = NULL;
+    StateTransition_t transition = NULL;
+    
+    if (verbose) {
+        m->print(false, true);
+        funcs = funcMap->get(m->name);
+        ASSERT (funcs);
+        UpdateState_t printValue = (UpdateState_t) funcs->print->function;
+        if (printValue) {
+            model_print("\t**********  Value Info  **********\n");
+            (*printValue)(m);
+        }
+    }
+
+    funcs = funcMap->get(m->name);
+    ASSERT (funcs);
+
+    CheckState_t preCondition = (CheckState_t)
+        funcs->preCondition->function;
+    // @PreCondition of Mehtod m
+    if (preCondition) {
+        satisfied = (*preCondition)(state, m);
+
+        if (!satisfied) {
+            model_print("PreCondition is not satisfied. Problematic method"
+                " is as follow: \n");
+            m->print(true, true);
+            printOneHistory(history, "Failed History");
+            if (verbose) {
+                if (historyIndex > 0)
+                    model_print("---- Check history #%d END ----\n\n",
+                        historyIndex);
+                else
+                    model_print("---- Check history END ----\n\n");
+            }
+            return false;
+        }
+    }
+
+    // After checking the PreCondition, we run the transition on the
+    // state node to update its state
+    transition = (StateTransition_t) funcs->transition->function;
+    // @Transition on the state
+    satisfied = (*transition)(state, m);
+    if (!satisfied) { // Error in evaluating @Transition
+        model_print("Transition returns false. Problematic method"
+            " is as follow: \n");
+        m->print(true, true);
+        printOneHistory(history, "Failed History");
+        if (verbose) {
+            if (historyIndex > 0)
+                model_print("---- Check history #%d END ----\n\n",
+                    historyIndex);
+            else
+                model_print("---- Check history END ----\n\n");
+        }
+        return false;
+    }
+
+    if (verbose) {
+        model_print("\t@Transition on itself\n");
+        if (printStateFunc) {
+            model_print("\t**********  State Info  **********\n");
+            (*printStateFunc)(state);
+        }
+    }
+    
+    // @PostCondition of Mehtod m
+    CheckState_t postCondition = (CheckState_t)
+        funcs->postCondition->function;
+    if (postCondition) {
+        satisfied = (*postCondition)(state, m);
+
+        if (!satisfied) {
+            model_print("PostCondition is not satisfied. Problematic method"
+                " is as follow: \n");
+            m->print(true, true);
+            printOneHistory(history, "Failed History");
+            if (verbose) {
+                if (historyIndex > 0)
+                    model_print("---- Check history #%d END ----\n\n",
+                        historyIndex);
+                else
+                    model_print("---- Check history END ----\n\n");
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+    Check the justifying subhistory of method call m (which only depends on the
+    part of history before m) unless m has been justified already
+*/
+void ExecutionGraph::justifyMethod(MethodList *history, Method m, bool
+    verbose, int historyIndex) {
+    StateFunctions *funcs = NULL;
+    // Check justifying subhistory
+    if (!m->justified) {
+        funcs = funcMap->get(m->name);
+        CheckState_t justifyingPrecondition = (CheckState_t)
+            funcs->justifyingPrecondition->function;
+        CheckState_t justifyingPostcondition = (CheckState_t)
+            funcs->justifyingPostcondition->function;
+        if (!justifyingPrecondition && !justifyingPostcondition ) {
+            // No need to check justifying conditions
+            m->justified = true;
+            if (verbose) {
+                model_print("\tMethod call  ");
+                m->print(false, false);
+                model_print(": automatically justified.\n");
+            }
+        } else {
+            bool justified = checkJustifyingSubhistory(history, m, verbose, historyIndex);
+            if (justified) {
+                // Set the "justified" flag --- no need to check again for cur
+                m->justified = true;
+                if (verbose) {
+                    model_print("\tMethod call  ");
+                    m->print(false, false);
+                    model_print(": is justified\n");
+                }
+            } else {
+                if (verbose) {
+                    model_print("\tMethod call  ");
+                    m->print(false, false);
+                    model_print(": has NOT been justified yet\n");
+                }
+            }
+        }
+    } else {
+        if (verbose) {
+            model_print("\tMethod call  ");
+            m->print(false, false);
+            model_print(": is justified\n");
+        }
+    }
+}
+
 bool ExecutionGraph::checkJustifyingSubhistory(MethodList *history, Method
     cur, bool verbose, int historyIndex) {
     if (verbose) {
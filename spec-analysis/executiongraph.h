@@ -78,8 +78,12 @@ class ExecutionGraph {
     /** Check whether a number of random history is correct */
     bool checkRandomHistories(int num = 1, bool stopOnFail = true, bool verbose = false);
 
-    /** Check whether all histories are correct */
-    bool checkAllHistories(bool stopOnFailure = true, bool verbose = false);
+    /**
+        Check whether all histories are correct, in up to jobs worker
+        processes (in this process if jobs is 0 or 1)
+    */
+    bool checkAllHistories(bool stopOnFailure = true, bool verbose = false,
+        int jobs = 0);
     
     /********** A few public printing functions for DEBUGGING **********/
 
@@ -124,6 +128,29 @@ class ExecutionGraph {
     */
     MethodList *randomHistory;
 
+    /**
+        When checking all histories, the states of the sequential data
+        structure after each prefix of the current history (indexed by the
+        prefix length)
+    */
+    MethodVector *prefixStates;
+
+    /** The number of worker processes to check all histories with */
+    int numWorkers;
+
+    /**
+        In a worker process: its number, and the length of the history where
+        the workers split the branches; -1 otherwise
+    */
+    int workerId;
+    int workerLevel;
+
+    /** Shared by the worker processes: set once one of them has failed */
+    volatile int *workerStop;
+
+    /** Whether this worker process has been stopped by another one */
+    bool workerStopped;
+
     /** Whether this is a broken graph */
     bool broken;
 
@@ -262,16 +289,39 @@ class ExecutionGraph {
     MethodVector* getEndNodes();
 
     /**
-        A helper function for generating and check all sequential histories. Before calling this function, initialize an empty
-        MethodList , and pass it as curList. Also pass the size of the method
-        list as the numLiveNodes.
+        A helper function for generating and check all sequential histories.
+        Before calling this function, initialize an empty MethodList, and pass
+        it as history, with an empty sleep set. Also pass the size of the
+        method list as the numLiveNodes.
 
         If you only want to stop the checking process when finding one failed
         history, pass true to stopOnFailure.
     */
-    bool checkAllHistoriesHelper(MethodList *curList, int &numLiveNodes, int
-    &historyNum, bool stopOnFailure, bool verbose);
+    bool checkAllHistoriesHelper(MethodList *history, MethodSet sleep, int
+        &numLiveNodes, int &historyNum, bool stopOnFailure, bool verbose);
+
+    /**
+        Check the method call just appended to history, on the state after the
+        rest of history (in prefixStates)
+    */
+    bool checkHistoryPrefix(MethodList *history);
+
+    /**
+        Check the histories extending history in numWorkers worker processes,
+        which split the branches from there
+    */
+    bool checkBranchesInWorkers(MethodList *history, MethodSet sleep, int
+        &numLiveNodes, int &historyNum, bool stopOnFailure, bool verbose);
+
+    /**
+        Check the branches of one of the worker processes, in this process
+    */
+    bool checkBranchesOfWorker(int k, MethodList *history, MethodSet sleep,
+        int &numLiveNodes, int &historyIndex, bool stopOnFailure, bool
+        verbose);
 
+    /** Whether the commutativity rules say m1 and m2 commute */
+    bool commute(Method m1, Method m2);
 
     /** Check whether a specific history is correct */
     bool checkHistory(MethodList *history, int historyIndex, bool verbose = false);
@@ -321,6 +371,18 @@ class ExecutionGraph {
     */
     bool checkStateSpec(MethodList *history, bool verbose, int historyNum);
 
+    /**
+        Check method call m of history on the state of the sequential data
+        structure in the state node (@PreCondition, @Transition &
+        @PostCondition)
+    */
+    bool checkMethodSpec(Method state, Method m, MethodList *history, bool
+        verbose, int historyNum);
+
+    /** Check the justifying subhistory of m unless it is justified already */
+    void justifyMethod(MethodList *history, Method m, bool verbose, int
+        historyNum);
+
     /**
         Check the justifying subhistory with respect to history of m.
     */
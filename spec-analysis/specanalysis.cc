@@ -8,6 +8,7 @@
 #include <assert.h>
 #include "modeltypes.h"
 #include "executiongraph.h"
+#include "config.h"
 
 
 SPECAnalysis::SPECAnalysis()
@@ -20,6 +21,7 @@ SPECAnalysis::SPECAnalysis()
     checkCyclic = false;
     stopOnFail = false;
     checkRandomNum = 0;
+    checkJobs = 0;
 }
 
 SPECAnalysis::~SPECAnalysis() {
@@ -117,6 +119,13 @@ bool SPECAnalysis::option(char * opt) {
         return false;
     } else if (isCheckRandomHistories(opt, checkRandomNum)) {
         return false;
+    } else if (strncmp(opt, "jobs-", 5) == 0 && atoi(opt + 5) > 0) {
+#if USE_MPROTECT_SNAPSHOT
+        checkJobs = atoi(opt + 5);
+#else
+        model_print("Fork-based snapshotting does not support jobs-N; checking histories in a single process\n");
+#endif
+        return false;
     } else if (strcmp(opt, "help") != 0) {
         model_print("Unrecognized option: %s\n", opt);
     } 
@@ -128,6 +137,7 @@ bool SPECAnalysis::option(char * opt) {
         "inadmissible-quiet -- print the inadmissible\n"
         "check-one -- only check one random possible topological"
             "sortings (check all possible by default)\n"
+        "jobs-N -- check all histories in N worker processes\n"
     );
     model_print("\n");
     
@@ -206,7 +216,8 @@ void SPECAnalysis::analyze(action_list_t *actions) {
     } else { // Check all histories 
         if (print_always && !quiet)
             model_print("Check all histories...\n");
-        pass = graph->checkAllHistories(true, print_always && !quiet);
+        pass = graph->checkAllHistories(true, print_always && !quiet,
+            checkJobs);
     }
 
     if (!pass) {
@@ -68,6 +68,8 @@ class SPECAnalysis : public TraceAnalysis {
     /* The number of random histories to be checked; If 0, we check all possible
      * histories */
     int checkRandomNum;
+    /* The number of worker processes to check all histories with */
+    int checkJobs;
     
     /** Whether this is a "check-12" like option */
     bool isCheckRandomHistories(char *opt, int &num);
@@ -0,0 +1,70 @@
+/*
+ * Race detection on whole buffers, through the range calls of librace:
+ * store_range(), load_range(), race_memcpy() and race_memset().
+ *
+ * The accesses to racy[] by the two threads are unordered, so a data race
+ * should be reported @ an address within racy[]. The
+ * accesses to safe[] are ordered by the release/acquire on flag (or by
+ * thrd_create/thrd_join), so no race should be reported within safe[]. The
+ * addresses of both buffers are printed out to compare with the reports.
+ */
+#include <stdio.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "librace.h"
+
+#define SIZE 256
+
+static char racy[SIZE];
+static char safe[SIZE];
+atomic_int flag;
+
+static void writer(void *obj)
+{
+    race_memset(racy, 1, SIZE);
+    race_memset(safe, 2, SIZE);
+    atomic_store_explicit(&flag, 1, memory_order_release);
+}
+
+static void reader(void *obj)
+{
+    char buf[SIZE];
+
+    /* Unordered with the writer */
+    race_memcpy(buf, racy, SIZE);
+    load_range(racy + SIZE / 2, SIZE / 2);
+
+    if (atomic_load_explicit(&flag, memory_order_acquire) == 1) {
+        /* Ordered after the writer */
+        race_memcpy(buf, safe, SIZE);
+        load_range(safe, SIZE);
+        store_range(safe, SIZE);
+        memset(safe, 3, SIZE);
+    }
+}
+
+int user_main(int argc, char **argv)
+{
+    thrd_t t1, t2;
+    char buf[SIZE];
+
+    printf("racy: %p-%p\n", (void *)racy, (void *)(racy + SIZE - 1));
+    printf("safe: %p-%p\n", (void *)safe, (void *)(safe + SIZE - 1));
+
+    atomic_init(&flag, 0);
+    race_memset(safe, 0, SIZE);
+
+    thrd_create(&t1, (thrd_start_t)&writer, NULL);
+    thrd_create(&t2, (thrd_start_t)&reader, NULL);
+
+    thrd_join(t1);
+    thrd_join(t2);
+
+    /* Ordered after both threads */
+    race_memcpy(buf, racy, SIZE);
+    race_memcpy(buf, safe, SIZE);
+
+    return 0;
+}
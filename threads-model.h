@@ -150,6 +150,8 @@ private:
 };
 
 Thread * thread_current();
+void stack_pool_init();
+bool stack_guard_hit(const void *addr);
 
 static inline thread_id_t thrd_to_id(thrd_t t)
 {
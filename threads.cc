@@ -3,6 +3,9 @@
  */
 
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
 
 #include <threads.h>
 #include <mutex>
@@ -10,20 +13,105 @@
 #include "threads-model.h"
 #include "action.h"
 #include "stacktrace.h"
+#include "snapshot.h"
 
 /* global "model" object */
 #include "model.h"
 
+/** @brief Size of a pooled stack, including the guard page below it */
+#define STACK_SLOT_SIZE (STACK_SIZE + PAGESIZE)
+
+/** @brief The reserved memory for the pooled stacks; see stack_pool_init() */
+static char *stack_pool = NULL;
+
+/** @brief Whether each pooled stack was added to the snapshotted regions */
+static bool stack_registered[STACK_POOL_SLOTS];
+
+/**
+ * @brief The pooled stacks not in use
+ *
+ * Lives in the snapshotting heap, so that rolling back returns the stacks of
+ * the Threads created since the snapshot (and takes back those of the Threads
+ * which completed since).
+ */
+struct stack_free_list {
+    unsigned int num_free;
+    unsigned int slots[STACK_POOL_SLOTS];
+};
+
+static struct stack_free_list *free_stacks = NULL;
+
+/**
+ * @brief Reserve the pool of thread stacks
+ *
+ * The stacks are reserved but not populated, and each one joins the
+ * snapshotted regions only when a Thread first runs on it. Stack pages which
+ * no Thread ever touches thus cost the snapshots nothing, and the pages a
+ * Thread did touch are reused by the Threads of the following executions.
+ *
+ * Must be called before taking the first snapshot; otherwise rolling back
+ * would free the list of free stacks itself.
+ */
+void stack_pool_init()
+{
+    void *mem = mmap(NULL, STACK_POOL_SLOTS * STACK_SLOT_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    stack_pool = (char *)mem;
+
+    free_stacks = (struct stack_free_list *)snapshot_malloc(sizeof(*free_stacks));
+    free_stacks->num_free = STACK_POOL_SLOTS;
+    for (unsigned int i = 0; i < STACK_POOL_SLOTS; i++) {
+        /* Catch stack overflows, rather than corrupt the stack below */
+        if (mprotect(stack_pool + i * STACK_SLOT_SIZE, PAGESIZE, PROT_NONE) == -1) {
+            perror("mprotect");
+            exit(EXIT_FAILURE);
+        }
+        /* Hand out the lowest stacks first */
+        free_stacks->slots[i] = STACK_POOL_SLOTS - 1 - i;
+    }
+}
+
+/**
+ * @brief Check whether an address lies in the guard page of a pooled stack
+ * @param addr The faulting address
+ * @return True if a Thread overflowed its stack
+ */
+bool stack_guard_hit(const void *addr)
+{
+    if (!stack_pool)
+        return false;
+    uintptr_t offset = (uintptr_t)addr - (uintptr_t)stack_pool;
+    return offset < (uintptr_t)STACK_POOL_SLOTS * STACK_SLOT_SIZE &&
+            offset % STACK_SLOT_SIZE < PAGESIZE;
+}
+
 /** Allocate a stack for a new thread. */
 static void *stack_allocate(size_t size)
 {
-    return Thread_malloc(size);
+    if (!free_stacks || free_stacks->num_free == 0 || size > STACK_SIZE)
+        return Thread_malloc(size);
+
+    unsigned int slot = free_stacks->slots[--free_stacks->num_free];
+    char *stack = stack_pool + slot * STACK_SLOT_SIZE + PAGESIZE;
+    if (!stack_registered[slot]) {
+        stack_registered[slot] = true;
+        snapshot_add_memory_region(stack, STACK_SIZE / PAGESIZE);
+    }
+    return stack;
 }
 
 /** Free a stack for a terminated thread. */
 static void stack_free(void *stack)
 {
-    Thread_free(stack);
+    uintptr_t offset = (uintptr_t)stack - (uintptr_t)stack_pool;
+    if (stack_pool && offset < (uintptr_t)STACK_POOL_SLOTS * STACK_SLOT_SIZE)
+        free_stacks->slots[free_stacks->num_free++] = offset / STACK_SLOT_SIZE;
+    else
+        Thread_free(stack);
 }
 
 /**
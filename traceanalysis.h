@@ -15,6 +15,21 @@ class TraceAnalysis {
 
     virtual void analyze(action_list_t *) = 0;
 
+    /** analyzePrefix is called before the model checker takes a
+     *  mid-execution snapshot (see --snapshotinterval), with the actions
+     *  so far. Work done here on these actions is rolled back with the
+     *  snapshot, so the analyze() calls of all executions resuming from it
+     *  can skip that work. */
+
+    virtual void analyzePrefix(action_list_t *) {}
+
+    /** Whether analyze() copes with executions resuming from a
+     *  mid-execution snapshot, which share the actions (and any state the
+     *  analysis keeps for them) up to the snapshot. Partial rollback is
+     *  disabled while an analysis not supporting it is installed. */
+
+    virtual bool canRollBackPartially() { return false; }
+
     /** name returns the analysis name string */
 
     virtual const char * name() = 0;
@@ -45,6 +60,25 @@ class TraceAnalysis {
      * restart the model checker. */
     virtual void actionAtModelCheckingFinish() {}
 
+    /** Whether analyze() may run in a forked process (see
+     *  --analysisjobs), on a copy of the model checker's state, while the
+     *  model checker explores further executions. Such an analysis must not
+     *  influence the exploration, and must pass back anything finish()
+     *  reports through saveResults() and mergeResults(). */
+    virtual bool canAnalyzeAsync() { return false; }
+
+    /** Called in the forked process before analyze(), to forget the
+     *  results inherited from the model checker. */
+    virtual void clearResults() {}
+
+    /** Called in the forked process after analyze(). Saves at most size
+     *  bytes of results to buf, and returns the number of bytes saved. */
+    virtual size_t saveResults(void *buf, size_t size) { return 0; }
+
+    /** Called in the model checker with results saved by a forked
+     *  process. */
+    virtual void mergeResults(const void *buf, size_t size) {}
+
     SNAPSHOTALLOC
 };
 #endif